@@ -3,6 +3,7 @@
 
 #include "ext_math.h"
 #include "ext_vector.h"
+#include "ext_matrix.h"
 
 typedef struct {
 	Vec3f v[3];
@@ -10,18 +11,59 @@ typedef struct {
 	u8    cullFrontface;
 } Triangle;
 
+typedef f32 f32x8 __attribute__((vector_size(32), aligned(4)));
+typedef s32 s32x8 __attribute__((vector_size(32), aligned(4)));
+
+// Precomputed SoA layout of 8 triangles, cull flags are lane masks
+typedef struct {
+	f32x8 v0[3];
+	f32x8 e1[3];
+	f32x8 e2[3];
+	s32x8 cullBackface;
+	s32x8 cullFrontface;
+} TriBlock;
+
 typedef struct {
 	Triangle* head;
 	u32       max;
 	u32       num;
+	
+	// TriBuffer_Precompute
+	TriBlock* block;
+	u32       numBlockTri;
 } TriBuffer;
 
+typedef struct {
+	Vec3f min;
+	Vec3f max;
+	u32   index; // leaf: first triIndex, node: right child
+	u32   num;   // leaf: triangle count, node: 0
+} BVHNode;
+
+typedef struct {
+	TriBuffer* triBuf;
+	BVHNode*   node;
+	u32*       triIndex;
+	u32        numNode;
+	u32        numTri;
+} TriBufferBVH;
+
 typedef struct {
 	Vec3f start;
 	Vec3f end;
 	f32   nearest;
 } RayLine;
 
+// Up to 8 lines tested together against one triangle
+typedef struct {
+	f32x8 start[3];
+	f32x8 dir[3];
+	f32x8 dist;
+	f32x8 nearest;
+	s32x8 hit;
+	u32   num;
+} RayPacket;
+
 typedef struct {
 	Vec3f pos;
 	f32   r;
@@ -33,13 +75,96 @@ typedef struct {
 	f32   r;
 } Cylinder;
 
+typedef enum {
+	COLSHAPE_NONE,
+	COLSHAPE_SPHERE,
+	COLSHAPE_CYLINDER,
+	COLSHAPE_TRIBUF,
+} ColShapeType;
+
+typedef s32 ColShapeID;
+
+typedef struct {
+	ColShapeType type;
+	union {
+		Sphere   sph;
+		Cylinder cyl;
+		struct {
+			TriBuffer*    triBuf;
+			TriBufferBVH* bvh;
+		};
+	};
+	MtxF  mtx; // cylinder space, computed on insert and move
+	MtxF  inv;
+	Vec3f min;
+	Vec3f max;
+	s32   cell[2][3];
+	bool  large;
+	s32   next;
+	void* udata;
+} ColShape;
+
+typedef struct {
+	s32 cell[3];
+	s32 shape;
+	s32 next;
+} ColCell;
+
+typedef struct {
+	f32   cellSize;
+	f32   maxExtent;
+	Vec3f min;
+	Vec3f max;
+	
+	ColShape* shape;
+	u32       numShape;
+	u32       maxShape;
+	s32       freeShape;
+	
+	ColCell* cell;
+	u32      numCell;
+	u32      maxCell;
+	s32      freeCell;
+	s32*     bucket;
+	u32      numBucket;
+	u32      numUsedCell;
+	
+	s32* large;
+	u32  numLarge;
+	u32  maxLarge;
+} ColWorld;
+
 void TriBuffer_Alloc(TriBuffer* this, u32 num);
 void TriBuffer_Realloc(TriBuffer* this);
 void TriBuffer_Free(TriBuffer* this);
+void TriBuffer_Precompute(TriBuffer* this);
 RayLine RayLine_New(Vec3f start, Vec3f end);
+void RayPacket_New(RayPacket* this, RayLine* ray, u32 num);
 bool Col3D_LineVsTriangle(RayLine* ray, Triangle* tri, Vec3f* outPos, Vec3f* outNor, bool cullBackface, bool cullFrontface);
 bool Col3D_LineVsTriBuffer(RayLine* ray, TriBuffer* triBuf, Vec3f* outPos, Vec3f* outNor);
+bool Col3D_LineVsTriBufferSoA(RayLine* ray, TriBuffer* triBuf, Vec3f* outPos, Vec3f* outNor);
+u32 Col3D_LinePacketVsTriangle(RayPacket* packet, Triangle* tri, s32 id, bool cullBackface, bool cullFrontface);
+u32 Col3D_LinePacketVsTriBuffer(RayPacket* packet, TriBuffer* triBuf);
+void TriBufferBVH_Build(TriBufferBVH* this, TriBuffer* triBuf);
+void TriBufferBVH_Refit(TriBufferBVH* this);
+void TriBufferBVH_Free(TriBufferBVH* this);
+bool Col3D_LineVsTriBufferBVH(RayLine* ray, TriBufferBVH* bvh, Vec3f* outPos, Vec3f* outNor);
+bool Col3D_RayVsTriBufferBVH(RayLine* ray, TriBufferBVH* bvh, Vec3f* outPos, Vec3f* outNor);
 bool Col3D_LineVsCylinder(RayLine* ray, Cylinder* cyl, Vec3f* outPos);
 bool Col3D_LineVsSphere(RayLine* ray, Sphere* sph, Vec3f* outPos);
 
+void ColWorld_Init(ColWorld* this, f32 cellSize);
+void ColWorld_Free(ColWorld* this);
+ColShapeID ColWorld_AddSphere(ColWorld* this, Sphere* sph, void* udata);
+ColShapeID ColWorld_AddCylinder(ColWorld* this, Cylinder* cyl, void* udata);
+ColShapeID ColWorld_AddTriBuffer(ColWorld* this, TriBuffer* triBuf, TriBufferBVH* bvh, void* udata);
+void ColWorld_MoveSphere(ColWorld* this, ColShapeID id, Sphere* sph);
+void ColWorld_MoveCylinder(ColWorld* this, ColShapeID id, Cylinder* cyl);
+void ColWorld_UpdateTriBuffer(ColWorld* this, ColShapeID id);
+void ColWorld_Remove(ColWorld* this, ColShapeID id);
+ColShape* ColWorld_Get(ColWorld* this, ColShapeID id);
+ColShapeID ColWorld_LineTest(ColWorld* this, RayLine* ray, Vec3f* outPos, Vec3f* outNor);
+ColShapeID ColWorld_RayTest(ColWorld* this, RayLine* ray, Vec3f* outPos, Vec3f* outNor);
+u32 ColWorld_Overlap(ColWorld* this, Sphere* sph, Arli* out);
+
 #endif
@@ -210,6 +210,7 @@ void Input_End(Input* input);
 const char* Input_GetClipboardStr(Input* input);
 void Input_SetClipboardStr(Input* input, const char* str);
 InputType* Input_GetKey(Input* input, int key);
+bool Input_IsActive(Input* input);
 InputType* Input_GetCursor(Input* input, CursorClick type);
 f32 Input_GetScrollRaw(Input* this);
 f32 Input_GetScroll(Input* this);
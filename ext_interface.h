@@ -44,8 +44,11 @@ typedef struct Window {
 	WindowState state;
 	
 	bool tick;
+	f32  maxFPS; // 0 leaves pacing to vsync
 	struct {
-		f32 tickMod;
+		f32  tickMod;
+		f64  frameTime;
+		bool redraw; // Set from any thread, only through __atomic builtins
 	} private;
 } Window;
 
@@ -69,6 +72,8 @@ void* Window_Init(
 );
 void Window_Close(Window* window);
 void Window_Update(Window* window);
+void Window_RequestRedraw(Window* window);
+void Window_SetFrameCap(Window* window, f32 fps);
 void Window_SetParam(Window* window, u32 num, ...);
 
 #define GUI_INITIALIZE( \
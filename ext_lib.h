@@ -126,6 +126,12 @@ void Ini_WriteTab(Memfile* mem, const char* variable, const char* comment);
 /*============================================================================*/
 
 char* regex(const char* str, const char* pattern, enum RegexFlag flag);
+int Regex_Compile(Regex* this, const char* pattern, int flags);
+bool Regex_Match(Regex* this, const char* str, RegexMatch* match, u32 num);
+u32 Regex_FindAll(Regex* this, const char* str, RegexMatch* match, u32 max);
+size_t Regex_Scan(Regex* this, const void* data, size_t size, Arli* out);
+size_t Regex_ScanMem(Regex* this, Memfile* mem, Arli* out);
+void Regex_Free(Regex* this);
 
 /*============================================================================*/
 
@@ -280,6 +286,10 @@ void* Parallel_Add(void* function, void* arg);
 void Parallel_Exec(u32 max);
 void Parallel_SetID(void* __this, int id);
 void Parallel_SetDepID(void* __this, int id);
+void Parallel_For(u32 num, u32 max, void* function, void* arg);
+bool Jobserver_Active(void);
+bool Jobserver_Acquire(int timeout);
+void Jobserver_Release(void);
 #endif
 
 /*============================================================================*/
@@ -489,6 +499,7 @@ int sys_rmdir(const char* item);
 void sys_setworkdir(const char* txt);
 int sys_touch(const char* file);
 int sys_cp(const char* src, const char* dest);
+int sys_cpu(const char* src, const char* dest);
 date_t sys_timedate(time_t time);
 int sys_getcorenum(void);
 size_t sys_statsize(const char* file);
@@ -498,6 +509,7 @@ const char* sys_volumename(const char* volume);
 
 int sys_exe(const char* cmd);
 void sys_exed(const char* cmd);
+int sys_exec(const char* cmd, int (*callback)(void*, const char*, size_t), void* arg);
 int sys_exel(const char* cmd, int (*callback)(void*, const char*), void* arg);
 void sys_exes_noerr();
 int sys_exes_return();
@@ -613,6 +625,11 @@ static inline int thd_join(thread_t* thread) {
 	return pthread_join(*thread, NULL);
 }
 
+__attribute__((always_inline))
+static inline int thd_detach(thread_t* thread) {
+	return pthread_detach(*thread);
+}
+
 #define mutex_scope(mutex_var, ...) do { \
 			mutex_lock(&mutex_var); \
 			{ __VA_ARGS__ } \
@@ -100,6 +100,10 @@ ASSET_FILENAME = $(notdir $(basename $<))
 
 Proc_Linux_O    += bin/linux/libreproc.a
 Proc_Win32_O    += bin/win32/libreproc.a
+Image_Linux_O   += $(Zip_Linux_O)
+Image_Win32_O   += $(Zip_Win32_O)
+ExtGui_Linux_O  += $(Zip_Linux_O)
+ExtGui_Win32_O  += $(Zip_Win32_O)
 
 define GD_WIN32
 	@echo -n $(dir $@) > $(@:.o=.d)
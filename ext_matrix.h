@@ -29,11 +29,13 @@ typedef union {
 	};
 } MtxF;
 
-extern MtxF* gMatrixStack;
-extern MtxF* gCurrentMatrix;
+extern thread_local MtxF* gMatrixStack;
+extern thread_local MtxF* gCurrentMatrix;
 extern const MtxF gMtxFClear;
 
+void Matrix_SetStackDepth(u32 depth);
 void Matrix_Init();
+void Matrix_Free(void);
 void Matrix_Clear(MtxF* mf);
 void Matrix_Push(void);
 void Matrix_Pop(void);
@@ -65,6 +67,7 @@ void Matrix_LookAt(MtxF* mf, Vec3f eye, Vec3f at, Vec3f up);
 
 void Matrix_MtxFTranslateRotateZYX(MtxF* cmf, Vec3f* translation, Vec3s* rotation);
 void Matrix_TranslateRotateZYX(Vec3f* translation, Vec3s* rotation);
+void Matrix_MtxFRotateAToB(MtxF* cmf, Vec3f* a, Vec3f* b, u8 mode);
 void Matrix_RotateAToB(Vec3f* a, Vec3f* b, u8 mode);
 void Matrix_MultVec4f_Ext(Vec4f* src, Vec4f* dest, MtxF* mtx);
 void Matrix_MtxFToYXZRotS(Vec3s* rotDest, s32 flag);
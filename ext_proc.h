@@ -28,6 +28,15 @@ typedef enum {
 	READ_STDERR,
 } e_ProcRead;
 
+typedef struct {
+	Arli queue;
+	u32  max;
+	bool lineMode;
+	void (*onOutput)(void* udata, Proc* proc, e_ProcRead target, const char* data, size_t size);
+	void (*onExit)(void* udata, Proc* proc, int signal);
+	void* udata;
+} ProcPool;
+
 Proc* Proc_New(char* fmt, ...);
 void Proc_AddArg(Proc* this, char* fmt, ...);
 void Proc_SetState(Proc* this, e_ProcState state);
@@ -43,6 +52,12 @@ int Proc_Join(Proc* this);
 
 void Proc_AddEach(Proc* this, ...);
 
+void ProcPool_Init(ProcPool* this, u32 max, bool lineMode);
+void ProcPool_SetCallback(ProcPool* this, void* onOutput, void* onExit, void* udata);
+void ProcPool_Add(ProcPool* this, Proc* proc);
+int ProcPool_Run(ProcPool* this);
+void ProcPool_Free(ProcPool* this);
+
 #ifndef __clang__
 #define Proc_AddEach(instance, ...) \
 		Proc_AddEach(instance, NARGS(__VA_ARGS__), __VA_ARGS__)
@@ -4,12 +4,20 @@
 #include <ext_lib.h>
 #include <ext_vector.h>
 
+typedef enum {
+	IMAGE_FILTER_BOX,
+	IMAGE_FILTER_TRIANGLE,
+	IMAGE_FILTER_MITCHELL,
+	IMAGE_FILTER_LANCZOS,
+} ImageFilter;
+
 typedef struct {
 	char     key[20];
 	int      x, y;
 	int      channels;
 	uint8_t* data;
 	u32      size;
+	u32      memSize;
 	int      compress;
 	char     type; // n: new, l: load, m: memory, 'r': mem raw
 	
@@ -18,14 +26,66 @@ typedef struct {
 	};
 } Image;
 
+typedef struct {
+	s32 x, y, w;
+} AtlasNode;
+
+typedef struct {
+	Image      img;
+	AtlasNode* node;
+	int        numNode;
+	bool       dirty;
+} AtlasPage;
+
+typedef struct {
+	Rect rect;
+	f32  u0, v0, u1, v1;
+	int  page;
+} AtlasEntry;
+
+typedef struct {
+	AtlasPage* page;
+	int  numPage;
+	int  w, h;
+	int  padding;
+	bool extrude;
+	Arli entry;
+} Atlas;
+
 Image Image_New(void);
 void Image_Load(Image* this, const char* file);
+int Image_LoadBatch(Image* out, const char** file, int num, int channels, const char** error);
 void Image_Save(Image* this, const char* file);
 void Image_LoadMem(Image* this, const void* data, size_t size);
 void Image_FromRaw(Image* this, const void* data, int x, int y, int channels);
 void Image_Alloc(Image* this, int x, int y, int channels);
 void Image_Free(Image* this);
 
+void Image_Resample(Image* dst, Image* src, int newx, int newy, ImageFilter filter);
+void Image_Resize(Image* this, int newx, int newy, ImageFilter filter);
 void Image_Downscale(Image* this, int newx, int newy);
+int Image_GenMips(Image* this, Image* mip, int num, ImageFilter filter);
+
+void Image_SwizzleBGRA(Image* dst, Image* src);
+void Image_Premultiply(Image* dst, Image* src);
+void Image_Unpremultiply(Image* dst, Image* src);
+void Image_ToRGB(Image* dst, Image* src);
+void Image_ToRGBA(Image* dst, Image* src);
+void Image_ToGray(Image* dst, Image* src);
+void Image_SrgbToLinear(Image* dst, Image* src);
+void Image_LinearToSrgb(Image* dst, Image* src);
+void Image_ToFloat(Image* this, f32* dst, bool linear);
+void Image_FromFloat(Image* this, const f32* src, int x, int y, int channels, bool linear);
+void Image_ToRGBA5551(Image* this, u16* dst);
+void Image_ToRGB565(Image* this, u16* dst);
+void Image_FromRGBA5551(Image* this, const u16* src, int x, int y);
+void Image_FromRGB565(Image* this, const u16* src, int x, int y);
+
+void Atlas_Init(Atlas* this, int w, int h, int padding, bool extrude);
+void Atlas_Free(Atlas* this);
+int Atlas_AddRaw(Atlas* this, const u8* rgba, int w, int h);
+int Atlas_Add(Atlas* this, Image* img);
+void Atlas_AddList(Atlas* this, Image* img, int num, int* id);
+AtlasEntry* Atlas_Get(Atlas* this, int id);
 
 #endif
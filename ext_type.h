@@ -187,6 +187,7 @@ typedef struct Memfile {
 		bool realloc    : 1;
 		bool getCrc     : 1;
 		bool throwError : 1;
+		bool external   : 1; // data is borrowed, never freed or resized in place
 		u64  initKey;
 	} param;
 	
@@ -285,6 +286,28 @@ enum RegexFlag {
 	REGFLAG_NUMMASK   = 0x00FFFFFF,
 };
 
+enum RegexCompFlag {
+	REGEX_ICASE   = 1 << 0,
+	REGEX_NEWLINE = 1 << 1,
+};
+
+typedef struct {
+	s32 so; // -1 if the group took no part in the match
+	s32 eo;
+} RegexMatch;
+
+typedef struct {
+	s64 so;
+	s64 eo;
+} RegexSpan;
+
+typedef struct {
+	void* reg;
+	u32   numSub;
+	char* lit; // literal every match starts with, for Regex_Scan
+	u32   litLen;
+} Regex;
+
 typedef enum {
 	ENV_USERNAME,
 	ENV_APPDATA,
@@ -9,6 +9,10 @@ typedef struct UndoEvent UndoEvent;
 void Undo_Init(u32 max);
 void Undo_Update(Input* input);
 void Undo_Destroy();
+void Undo_SetBudget(size_t bytes, bool deflate);
+void Undo_SetMergeTime(f64 sec);
+bool Undo_Undo();
+bool Undo_Redo();
 
 UndoEvent* Undo_New();
 void Undo_Register(UndoEvent* this, void* origin, size_t size);
@@ -110,6 +110,7 @@ typedef struct {
 
 extern const f32 EPSILON;
 extern f32 gDeltaTime;
+extern u32 gAnimTick;
 
 s16 Atan2S(f32 x, f32 y);
 void VecSphToVec3f(Vec3f* dest, VecSph* sph);
@@ -3,11 +3,68 @@
 
 #include "ext_lib.h"
 
+typedef struct {
+	const char* name;
+	u64  offset; // local header
+	u64  compSize;
+	u64  size;
+	u32  crc32;
+	u16  method;
+	bool isDir;
+} ZipEntry;
+
 typedef struct Zip {
 	void* pkg;
 	char* filename;
+	
+	struct {
+		ZipEntry* entry;
+		u32       num;
+		u32*      hash;
+		u32       hashMask;
+		u32*      sorted;
+		char*     names;
+	} index;
+	
+	struct {
+		u8*    data;
+		size_t size;
+		void*  handle;
+	} map;
 } Zip;
 
+typedef struct {
+	char*    name;
+	char*    file;
+	Memfile* mem;
+	int      level;
+	time_t   time;
+	
+	u8*  comp;
+	u64  compSize;
+	u64  size;
+	u64  offset;
+	u32  crc32;
+	u16  method;
+	int  error;
+} ZipWriterEntry;
+
+typedef struct {
+	Arli   entry;
+	int    level;
+	time_t time;
+} ZipWriter;
+
+typedef struct {
+	void*    state;
+	Memfile* out;
+	u8*      dict;
+	size_t   dictOfs;
+	int      error;
+	bool     inflate;
+	bool     done;
+} ZStream;
+
 enum {
 	ZIP_READ   = 'r',
 	ZIP_WRITE  = 'w',
@@ -20,8 +77,16 @@ enum {
 	ZIP_ERROR_CLOSE      = -2,
 };
 
+/**
+ * Entries read from an archive opened with ZIP_READ that are stored
+ * without compression borrow the archive mapping (param.external). They
+ * are valid until Zip_Free. Writing into one in place changes what later
+ * reads of that entry return, growing it with Memfile_Realloc first
+ * gives it a private copy.
+ */
 void* Zip_Load(Zip* zip, const char* file, char mode);
 int Zip_GetEntryNum(Zip* zip);
+ZipEntry* Zip_Find(Zip* zip, const char* entry);
 int Zip_ReadByName(Zip* zip, const char* entry, Memfile* mem);
 int Zip_ReadByID(Zip* zip, size_t index, Memfile* mem);
 int Zip_ReadPath(Zip* zip, const char* path, int (*callback)(const char* name, Memfile* mem));
@@ -29,4 +94,20 @@ int Zip_Write(Zip* zip, Memfile* mem, const char* entry);
 int Zip_Dump(Zip* zip, const char* path, int (*callback)(const char* name, f32 prcnt));
 void Zip_Free(Zip* zip);
 
+void ZipWriter_Init(ZipWriter* this, int level);
+void ZipWriter_AddMem(ZipWriter* this, const char* name, Memfile* mem, int level);
+void ZipWriter_AddFile(ZipWriter* this, const char* name, const char* file, int level);
+int ZipWriter_Write(ZipWriter* this, const char* file);
+void ZipWriter_Free(ZipWriter* this);
+
+void ZStream_Deflate(ZStream* this, Memfile* out, int level);
+void ZStream_Inflate(ZStream* this, Memfile* out);
+int ZStream_Write(ZStream* this, const void* data, size_t size);
+int ZStream_End(ZStream* this);
+
+int Memfile_Compress(Memfile* dst, Memfile* src, int level, u32 blockSize);
+int Memfile_Decompress(Memfile* dst, Memfile* src);
+int Memfile_SaveCompressed(Memfile* this, const char* file, int level);
+int Memfile_LoadCompressed(Memfile* this, const char* file);
+
 #endif
\ No newline at end of file
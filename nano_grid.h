@@ -606,6 +606,7 @@ void Gfx_DrawRounderOutlineWidth(void* vg, Rect rect, NVGcolor color, int width)
 void Gfx_DrawRounderRect(void* vg, Rect rect, NVGcolor color);
 void Gfx_Text(void* vg, Rect r, enum NVGalign align, NVGcolor col, const char* txt);
 void Gfx_Icon(void* vg, Rect r, NVGcolor col, int icon);
+NVGpaint Icon_Paint(void* vg, Rect r, int icon);
 void Gfx_TextShadow(void* vg);
 f32 Gfx_TextWidth(void* vg, const char* txt);
 
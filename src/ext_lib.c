@@ -7,6 +7,7 @@
 
 #include "ext_lib.h"
 #include <ftw.h>
+#include <errno.h>
 
 #ifndef EXTLIB_PERMISSIVE
 	#ifdef EXTLIB
@@ -23,6 +24,8 @@
 
 const f32 EPSILON = 0.0000001f;
 f32 gDeltaTime = 1.0f;
+// Bumped by every animation helper that moved a value, lets the GUI tell when it may idle
+u32 gAnimTick;
 
 // # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # #
 
@@ -1215,6 +1218,7 @@ f32 randf() {
 
 f32 Math_SmoothStepToF(f32* pValue, f32 target, f32 fraction, f32 step, f32 minStep) {
 	if (*pValue != target) {
+		gAnimTick++;
 		f32 stepSize = (target - *pValue) * fraction;
 		
 		if ((stepSize >= minStep) || (stepSize <= -minStep)) {
@@ -2512,41 +2516,192 @@ int sys_touch(const char* file) {
 	return 0;
 }
 
-int sys_cp(const char* src, const char* dest) {
-	if (sys_isdir(src)) {
-		List list = List_New();
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+#endif
+
+/**
+ * Copies one file without pulling it through user space when the kernel
+ * can help: reflink clone, then copy_file_range, then sendfile, then a
+ * plain read/write loop. The mtime is carried over so update mode can
+ * tell the copy is current.
+ */
+static int sys_cpfile(const char* src, const char* dest, bool update) {
+#ifdef _WIN32
+		wchar* src16 = calloc(strlen(src) * 4);
+		wchar* dest16 = calloc(strlen(dest) * 4);
+		int ret = 0;
 		
-		List_Walk(&list, src, -1, LIST_FILES);
+		if (update && sys_stat(dest) == sys_stat(src) && sys_statsize(dest) == sys_statsize(src)) {
+			delete(src16, dest16);
+			
+			return 0;
+		}
 		
-		for (int i = 0; i < list.num; i++) {
-			char* dfile = x_fmt(
-				"%s%s%s",
-				dest,
-				strend(dest, "/") ? "" : "/",
-				list.item[i] + strlen(src)
-			);
+		strto16(src16, src);
+		strto16(dest16, dest);
+		
+		// CopyFile keeps the timestamps on its own
+		if (!CopyFileW(src16, dest16, FALSE))
+			ret = sys_stat(src) ? 1 : -1;
+		
+		delete(src16, dest16);
+		
+		return ret;
+#else
+		struct stat st;
+		struct stat dst;
+		off_t left;
+		char* buf;
+		int in, out;
+		
+		if ((in = open(src, O_RDONLY | O_CLOEXEC)) < 0)
+			return -1;
+		
+		if (fstat(in, &st)) {
+			close(in);
+			
+			return -1;
+		}
+		
+		if (update && !stat(dest, &dst) && dst.st_size == st.st_size &&
+			dst.st_mtim.tv_sec == st.st_mtim.tv_sec && dst.st_mtim.tv_nsec == st.st_mtim.tv_nsec) {
+			close(in);
 			
-			osLog("Copy: %s -> %s", list.item[i], dfile);
+			return 0;
+		}
+		
+		if ((out = open(dest, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 0777)) < 0) {
+			close(in);
 			
-			sys_mkdir(x_path(dfile));
-			if (sys_cp(list.item[i], dfile))
-				return 1;
+			return 1;
 		}
 		
-		List_Free(&list);
-	} else {
-		Memfile a = Memfile_New();
+		left = st.st_size;
 		
-		a.param.throwError = false;
+#ifdef FICLONE
+			if (left && !ioctl(out, FICLONE, in))
+				left = 0;
+#endif
 		
-		if (Memfile_LoadBin(&a, src))
-			return -1;
-		if (Memfile_SaveBin(&a, dest))
+#ifdef SYS_copy_file_range
+			while (left > 0) {
+				ssize_t r = syscall(SYS_copy_file_range, in, NULL, out, NULL, left, 0);
+				
+				if (r <= 0)
+					break;
+				left -= r;
+			}
+#endif
+		
+		while (left > 0) {
+			ssize_t r = sendfile(out, in, NULL, left);
+			
+			if (r <= 0)
+				break;
+			left -= r;
+		}
+		
+		if (left > 0) {
+			buf = malloc(MbToBin(1));
+			
+			while (left > 0) {
+				ssize_t r = read(in, buf, MbToBin(1));
+				
+				if (r <= 0 || write(out, buf, r) != r)
+					break;
+				left -= r;
+			}
+			
+			delete(buf);
+		}
+		
+		futimens(out, (struct timespec[]) { st.st_atim, st.st_mtim });
+		close(in);
+		
+		if (close(out) || left > 0)
 			return 1;
-		Memfile_Free(&a);
+		
+		return 0;
+#endif
+}
+
+typedef struct {
+	char** src;
+	char** dest;
+	bool   update;
+	vs32   error;
+} sys_cp_t;
+
+static void sys_cpthd(sys_cp_t* this, u32 i) {
+	int r;
+	
+	if (this->error)
+		return;
+	
+	if ((r = sys_cpfile(this->src[i], this->dest[i], this->update)))
+		this->error = r;
+}
+
+/**
+ * Directories are walked up front, the folders created and then the files
+ * copied on Parallel_For. With update set files whose size and mtime
+ * already match the source are skipped.
+ */
+static int sys_cpimpl(const char* src, const char* dest, bool update) {
+	sys_cp_t this = { .update = update };
+	List list = List_New();
+	
+	if (!sys_isdir(src)) {
+		int r = sys_cpfile(src, dest, update);
+		
+		osLog("Copy: %s -> %s [%d]", src, dest, r);
+		
+		return r;
 	}
 	
-	return 0;
+	List_Walk(&list, src, -1, LIST_FILES);
+	
+	this.src = list.item;
+	this.dest = new(char*[list.num + 1]);
+	
+	for (int i = 0; i < list.num; i++) {
+		this.dest[i] = strdup(x_fmt(
+				"%s%s%s",
+				dest,
+				strend(dest, "/") ? "" : "/",
+				list.item[i] + strlen(src)
+		));
+		
+		osLog("Copy: %s -> %s", list.item[i], this.dest[i]);
+		
+		if (i == 0 || strcmp(x_path(this.dest[i]), x_path(this.dest[i - 1])))
+			sys_mkdir(x_path(this.dest[i]));
+	}
+	
+	Parallel_For(list.num, 0, sys_cpthd, &this);
+	
+	for (int i = 0; i < list.num; i++)
+		delete(this.dest[i]);
+	delete(this.dest);
+	List_Free(&list);
+	
+	return this.error;
+}
+
+int sys_cp(const char* src, const char* dest) {
+	return sys_cpimpl(src, dest, false);
+}
+
+// Like sys_cp but leaves files alone that already have the same size and mtime
+int sys_cpu(const char* src, const char* dest) {
+	return sys_cpimpl(src, dest, true);
 }
 
 date_t sys_timedate(time_t time) {
@@ -2741,25 +2896,182 @@ void sys_exed(const char* cmd) {
 #endif
 }
 
-int sys_exel(const char* cmd, int (*callback)(void*, const char*), void* arg) {
-	char* s;
-	FILE* file;
+#ifndef _WIN32
+#include <spawn.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+extern char** environ;
+
+// Splits cmd into argv when it has nothing a shell would have to expand
+static char** sys_exec_argv(const char* cmd) {
+	static const char* builtin[] = {
+		".", "cd", "command", "type", "ulimit", "export", "set", "unset", "alias", "exec", "umask", "read", "wait",
+	};
+	const char* p = cmd + strspn(cmd, " \t");
+	size_t len = strcspn(p, " \t");
+	char** argv;
+	int num = 0;
+	
+	if (strpbrk(cmd, "|&;<>()$`\\\"'*?[]{}#~!\n") || !*p || memchr(p, '=', len))
+		return NULL;
+	
+	for (int i = 0; i < ArrCount(builtin); i++)
+		if (strlen(builtin[i]) == len && !memcmp(p, builtin[i], len))
+			return NULL;
 	
-	if ((file = popen(sys_exe_s(cmd), "r")) == NULL) {
-		osLog(PRNT_REDD "sys_exes(%s);", cmd);
-		osLog("popen failed!");
+	argv = new(char*[strlen(cmd) / 2 + 2]);
+	
+	while (*p) {
+		len = strcspn(p, " \t");
 		
-		return -1;
+		argv[num++] = strndup(p, len);
+		p += len;
+		p += strspn(p, " \t");
 	}
 	
-	s = alloc(1025);
-	while (fgets(s, 1024, file))
-		if (callback)
-			if (callback(arg, s))
+	return argv;
+}
+#endif
+
+/**
+ * Runs cmd and passes its stdout to callback chunk by chunk as it is read,
+ * a non zero return from callback stops reading. Returns the exit status
+ * in the same form as pclose. Commands without shell syntax are spawned
+ * directly, anything else goes through /bin/sh. So do shell builtins and
+ * commands that are not found on PATH.
+ */
+int sys_exec(const char* cmd, int (*callback)(void*, const char*, size_t), void* arg) {
+	char* buf = malloc(0x10000);
+	int ret;
+
+#ifdef _WIN32
+		FILE* file;
+		size_t len;
+		
+		if ((file = popen(sys_exe_s(cmd), "rb")) == NULL) {
+			osLog(PRNT_REDD "sys_exec(%s);", cmd);
+			osLog("popen failed!");
+			delete(buf);
+			
+			return -1;
+		}
+		
+		while ((len = fread(buf, 1, 0x10000, file)))
+			if (callback && callback(arg, buf, len))
+				break;
+		
+		ret = pclose(file);
+#else
+		posix_spawn_file_actions_t act;
+		char** argv = sys_exec_argv(cmd);
+		char* sh[] = { "/bin/sh", "-c", (char*)cmd, NULL };
+		ssize_t len;
+		pid_t pid;
+		int fd[2];
+		int err;
+		
+		if (pipe(fd)) {
+			osLog(PRNT_REDD "sys_exec(%s);", cmd);
+			osLog("pipe failed!");
+			delete(buf);
+			
+			return -1;
+		}
+		
+		fcntl(fd[0], F_SETFD, FD_CLOEXEC);
+		fcntl(fd[1], F_SETFD, FD_CLOEXEC);
+		posix_spawn_file_actions_init(&act);
+		posix_spawn_file_actions_adddup2(&act, fd[1], STDOUT_FILENO);
+		
+		if (argv)
+			err = posix_spawnp(&pid, argv[0], &act, NULL, argv, environ);
+		
+		// Not on PATH, may still be a builtin or function of the shell
+		if (!argv || err == ENOENT)
+			err = posix_spawn(&pid, sh[0], &act, NULL, sh, environ);
+		
+		posix_spawn_file_actions_destroy(&act);
+		close(fd[1]);
+		
+		if (argv) {
+			for (int i = 0; argv[i]; i++)
+				delete(argv[i]);
+			delete(argv);
+		}
+		
+		if (err) {
+			osLog(PRNT_REDD "sys_exec(%s);", cmd);
+			osLog("spawn failed: %s", strerror(err));
+			close(fd[0]);
+			delete(buf);
+			
+			// Same as what the shell reports for a missing command
+			return 127 << 8;
+		}
+		
+		while ((len = read(fd[0], buf, 0x10000)) != 0) {
+			if (len < 0) {
+				if (errno == EINTR)
+					continue;
 				break;
-	delete(s);
+			}
+			
+			if (callback && callback(arg, buf, len))
+				break;
+		}
+		
+		close(fd[0]);
+		while (waitpid(pid, &ret, 0) < 0 && errno == EINTR) ;
+#endif
+	
+	delete(buf);
+	
+	return ret;
+}
+
+typedef struct {
+	Memfile line;
+	int (*callback)(void*, const char*);
+	void* arg;
+	bool  stop;
+} sys_exel_t;
+
+// Lines are passed with their newline, like fgets would
+static int sys_exel_split(sys_exel_t* this, const char* data, size_t size) {
+	const char* end;
+	
+	while ((end = memchr(data, '\n', size))) {
+		Memfile_Write(&this->line, data, end + 1 - data);
+		Memfile_Write(&this->line, "\0", 1);
+		
+		if (this->callback && this->callback(this->arg, this->line.str))
+			return this->stop = true;
+		
+		Memfile_Null(&this->line);
+		size -= end + 1 - data;
+		data = end + 1;
+	}
+	
+	if (size)
+		Memfile_Write(&this->line, data, size);
 	
-	return pclose(file);
+	return 0;
+}
+
+int sys_exel(const char* cmd, int (*callback)(void*, const char*), void* arg) {
+	sys_exel_t this = { Memfile_New(), callback, arg };
+	int ret;
+	
+	ret = sys_exec(cmd, (void*)sys_exel_split, &this);
+	
+	if (this.line.size && !this.stop && callback) {
+		Memfile_Write(&this.line, "\0", 1);
+		callback(arg, this.line.str);
+	}
+	
+	Memfile_Free(&this.line);
+	
+	return ret;
 }
 
 void sys_exes_noerr() {
@@ -2770,38 +3082,28 @@ int sys_exes_return() {
 	return sSysReturn;
 }
 
-char* sys_exes(const char* cmd) {
-	char* sExeBuffer;
-	char result[1025];
-	FILE* file = NULL;
-	u32 size = 0;
+static int sys_exes_append(Memfile* mem, const char* data, size_t size) {
+	Memfile_Write(mem, data, size);
 	
-	if ((file = popen(sys_exe_s(cmd), "r")) == NULL) {
-		osLog(PRNT_REDD "sys_exes(%s);", cmd);
-		osLog("popen failed!");
-		
-		return NULL;
-	}
-	
-	sExeBuffer = alloc(MbToBin(4));
-	osAssert(sExeBuffer != NULL);
-	sExeBuffer[0] = '\0';
+	return 0;
+}
+
+char* sys_exes(const char* cmd) {
+	Memfile mem = Memfile_New();
 	
-	while (fgets(result, 1024, file)) {
-		size += strlen(result);
-		osAssert (size < MbToBin(4));
-		strcat(sExeBuffer, result);
-	}
+	Memfile_Alloc(&mem, 0x10000);
+	sSysReturn = sys_exec(cmd, (void*)sys_exes_append, &mem);
+	Memfile_Write(&mem, "\0", 1);
 	
-	if ((sSysReturn = pclose(file)) != 0) {
+	if (sSysReturn != 0) {
 		if (sSysIgnore == 0) {
-			printf("%s\n", sExeBuffer);
+			printf("%s\n", mem.str);
 			osLog(PRNT_REDD "[%d] " PRNT_GRAY "sys_exes(" PRNT_REDD "%s" PRNT_GRAY ");", sSysReturn, cmd);
 			errr("sys_exes [%s]", sys_exe_s(cmd));
 		}
 	}
 	
-	return sExeBuffer;
+	return mem.str;
 }
 
 // # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # #
@@ -145,7 +145,14 @@ void Memfile_Realloc(Memfile* this, size_t size) {
 	if (this->memSize > size)
 		return;
 	
-	osAssert((this->data = realloc(this->data, size)) != NULL);
+	if (this->param.external) {
+		void* data = this->data;
+		
+		osAssert((this->data = malloc(size)) != NULL);
+		memcpy(this->data, data, this->size);
+		this->param.external = false;
+	} else
+		osAssert((this->data = realloc(this->data, size)) != NULL);
 	this->memSize = size;
 }
 
@@ -306,6 +313,7 @@ void Memfile_LoadMem(Memfile* this, const void* data, size_t size) {
 	Memfile_Null(this);
 	this->size = this->memSize = size;
 	this->data = (void*)data;
+	this->param.external = false;
 }
 
 int Memfile_LoadBin(Memfile* this, const char* filepath) {
@@ -440,6 +448,8 @@ static void Memfile_CleanLink(Memfile* this);
 
 void Memfile_Free(Memfile* this) {
 	if (this->param.initKey == 0xD0E0A0D0B0E0E0F0) {
+		if (this->param.external)
+			this->data = NULL;
 		delete(this->data, this->info.name);
 		
 		Memfile_CleanLink(this);
@@ -451,6 +461,11 @@ void Memfile_Free(Memfile* this) {
 void Memfile_Null(Memfile* this) {
 	this->size = 0;
 	this->seekPoint = 0;
+	if (this->param.external) {
+		this->data = NULL;
+		this->memSize = 0;
+		this->param.external = false;
+	}
 	if (this->data)
 		this->str[0] = '\0';
 }
@@ -1,6 +1,14 @@
 #include <ext_lib.h>
 #undef threadpool_setdep
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#endif
+
 // # # # # # # # # # # # # # # # # # # # #
 // # ThreadPool                          #
 // # # # # # # # # # # # # # # # # # # # #
@@ -116,6 +124,7 @@ void Parallel_Exec(u32 max) {
 	u32 prev = 1;
 	u32 prog = 0;
 	u32 cur = 0;
+	u32 token = 0;
 	thd_item_t* t;
 	bool msg = gParallel_ProgMsg != NULL;
 	
@@ -143,6 +152,14 @@ void Parallel_Exec(u32 max) {
 				t = t->next;
 			}
 			
+			// Every task next to the first one runs on a jobserver token
+			if (t && cur && token < cur) {
+				if (Jobserver_Acquire(1))
+					token++;
+				else
+					t = NULL;
+			}
+			
 			if (t) {
 				while (t->state != T_RUN)
 					t->state = T_RUN;
@@ -177,6 +194,10 @@ void Parallel_Exec(u32 max) {
 			Node_Kill(sThdPool->head, t);
 			
 			cur--;
+			if (token && token >= cur) {
+				Jobserver_Release();
+				token--;
+			}
 			sThdPool->num--;
 			prog++;
 		}
@@ -185,3 +206,204 @@ void Parallel_Exec(u32 max) {
 	gParallel_ProgMsg = NULL;
 	sThdPool->on = false;
 }
+
+// # # # # # # # # # # # # # # # # # # # #
+// # Parallel_For                        #
+// # # # # # # # # # # # # # # # # # # # #
+
+typedef struct {
+	void (*function)(void*, u32);
+	void* arg;
+	u32   num;
+	vu32  next;
+} parallel_for_t;
+
+static void* Parallel_ForThd(parallel_for_t* this) {
+	u32 i;
+	
+	while ((i = __atomic_fetch_add(&this->next, 1, __ATOMIC_RELAXED)) < this->num)
+		this->function(this->arg, i);
+	
+	return NULL;
+}
+
+static void* Parallel_ForHelperThd(parallel_for_t* this) {
+	while (!Jobserver_Acquire(10))
+		if (this->next >= this->num)
+			return NULL;
+	
+	Parallel_ForThd(this);
+	Jobserver_Release();
+	
+	return NULL;
+}
+
+/**
+ * Calls function(arg, i) for every i below num on up to max threads
+ * (0 for core count) and returns once all of them are done. Indices are
+ * handed out in order as threads become free. Unlike Parallel_Add this
+ * does not touch the global pool, so it is safe to use from inside a
+ * Parallel_Exec task. Helper threads only join in while they hold a
+ * jobserver token.
+ */
+void Parallel_For(u32 num, u32 max, void* function, void* arg) {
+	parallel_for_t this = {
+		.function = function,
+		.arg      = arg,
+		.num      = num,
+	};
+	
+	if (!max)
+		max = sys_getcorenum();
+	max = clamp(max, 1, num);
+	
+	if (max <= 1) {
+		Parallel_ForThd(&this);
+		
+		return;
+	}
+	
+	thread_t thd[max - 1];
+	
+	for (int i = 0; i < max - 1; i++)
+		if (thd_create(&thd[i], Parallel_ForHelperThd, &this))
+			errr("Parallel_For: Could not create thread");
+	
+	Parallel_ForThd(&this);
+	
+	for (int i = 0; i < max - 1; i++)
+		thd_join(&thd[i]);
+}
+
+// # # # # # # # # # # # # # # # # # # # #
+// # Jobserver                           #
+// # # # # # # # # # # # # # # # # # # # #
+
+static struct {
+	bool    active;
+	int     rfd;
+	int     wfd;
+	void*   sem;
+	mutex_t mutex;
+	u32     num;
+	char    token[1024];
+} sJobserver;
+
+/**
+ * Picks up the jobserver of a parent GNU make from MAKEFLAGS, either
+ * "--jobserver-auth=R,W" pipe fds, "fifo:PATH" or a semaphore name on
+ * Windows. Without one every Jobserver call is a no-op that succeeds.
+ */
+onlaunch_func_t Jobserver_Init() {
+	const char* flags = getenv("MAKEFLAGS");
+	const char* auth = NULL;
+	char* arg;
+	
+	if (!flags)
+		return;
+	
+	// The last one wins, sub-makes may append their own
+	for (const char* p = flags; (p = strstr(p, "--jobserver-")); p++) {
+		if (!strncmp(p, "--jobserver-auth=", 17))
+			auth = p + 17;
+		else if (!strncmp(p, "--jobserver-fds=", 16))
+			auth = p + 16;
+	}
+	
+	if (!auth)
+		return;
+	
+	arg = strndup(auth, strcspn(auth, " "));
+
+#ifdef _WIN32
+	sJobserver.sem = OpenSemaphoreA(SYNCHRONIZE | SEMAPHORE_MODIFY_STATE, FALSE, arg);
+	sJobserver.active = sJobserver.sem != NULL;
+#else
+	if (!strncmp(arg, "fifo:", 5)) {
+		sJobserver.rfd = sJobserver.wfd = open(arg + 5, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+		sJobserver.active = sJobserver.rfd >= 0;
+	} else if (sscanf(arg, "%d,%d", &sJobserver.rfd, &sJobserver.wfd) == 2) {
+		// make closes these for recipes not marked with '+'
+		sJobserver.active = sJobserver.rfd >= 0 && sJobserver.wfd >= 0 &&
+			fcntl(sJobserver.rfd, F_GETFD) >= 0 && fcntl(sJobserver.wfd, F_GETFD) >= 0;
+		
+		// A private description can be non blocking without affecting make,
+		// a blocking read on the shared one can hang after another job won the token
+		if (sJobserver.active) {
+			int fd = open(x_fmt("/proc/self/fd/%d", sJobserver.rfd), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+			
+			if (fd >= 0)
+				sJobserver.rfd = fd;
+			else {
+				osLog("jobserver: can not reopen fd %d, ignoring it", sJobserver.rfd);
+				sJobserver.active = false;
+			}
+		}
+	}
+#endif
+	
+	if (sJobserver.active)
+		pthread_mutex_init(&sJobserver.mutex, 0);
+	
+	delete(arg);
+}
+
+bool Jobserver_Active(void) {
+	return sJobserver.active;
+}
+
+/**
+ * Takes one token, waiting up to timeout milliseconds (-1 waits forever).
+ * The implicit token every make job owns is not counted, so callers only
+ * acquire for work beyond their first thread or child.
+ */
+bool Jobserver_Acquire(int timeout) {
+	if (!sJobserver.active)
+		return true;
+
+#ifdef _WIN32
+	return WaitForSingleObject(sJobserver.sem, timeout < 0 ? INFINITE : (DWORD)timeout) == WAIT_OBJECT_0;
+#else
+	struct pollfd pfd = { .fd = sJobserver.rfd, .events = POLLIN };
+	char c;
+	
+	while (true) {
+		ssize_t r = read(sJobserver.rfd, &c, 1);
+		
+		if (r == 1) {
+			pthread_mutex_lock(&sJobserver.mutex);
+			osAssert(sJobserver.num < sizeof(sJobserver.token));
+			sJobserver.token[sJobserver.num++] = c;
+			pthread_mutex_unlock(&sJobserver.mutex);
+			
+			return true;
+		}
+		
+		// End of file, make has gone away
+		if (r == 0 || (errno != EAGAIN && errno != EINTR))
+			return false;
+		
+		if (errno == EAGAIN && (!timeout || poll(&pfd, 1, timeout) <= 0))
+			return false;
+	}
+#endif
+}
+
+// Hands back the most recently taken token, make expects the same bytes back
+void Jobserver_Release(void) {
+	if (!sJobserver.active)
+		return;
+
+#ifdef _WIN32
+	ReleaseSemaphore(sJobserver.sem, 1, NULL);
+#else
+	char c = '+';
+	
+	pthread_mutex_lock(&sJobserver.mutex);
+	if (sJobserver.num)
+		c = sJobserver.token[--sJobserver.num];
+	pthread_mutex_unlock(&sJobserver.mutex);
+	
+	while (write(sJobserver.wfd, &c, 1) < 0 && errno == EINTR) ;
+#endif
+}
@@ -1,4 +1,5 @@
 #include <ext_lib.h>
+#include <ext_vector.h>
 #include <sys/time.h>
 
 typedef struct {
@@ -61,6 +62,8 @@ bool TimerDecr(Timer* this) {
 		return false;
 	}
 	
+	gAnimTick++;
+	
 	return true;
 }
 
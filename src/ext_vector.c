@@ -127,6 +127,7 @@ f32 Math_DelSmoothStepToF(f32* pValue, f32 target, f32 fraction, f32 step, f32 m
 	minStep *= gDeltaTime;
 	
 	if (*pValue != target) {
+		gAnimTick++;
 		f32 stepSize = (target - *pValue) * fraction;
 		
 		if ((stepSize >= minStep) || (stepSize <= -minStep)) {
@@ -171,6 +172,7 @@ f64 Math_DelSmoothStepToD(f64* pValue, f64 target, f64 fraction, f64 step, f64 m
 	minStep *= gDeltaTime;
 	
 	if (*pValue != target) {
+		gAnimTick++;
 		f64 stepSize = (target - *pValue) * fraction;
 		
 		if ((stepSize >= minStep) || (stepSize <= -minStep))
@@ -204,6 +206,7 @@ s16 Math_SmoothStepToS(s16* pValue, s16 target, s16 scale, s16 step, s16 minStep
 	s16 diff = target - *pValue;
 	
 	if (*pValue != target) {
+		gAnimTick++;
 		stepSize = diff / scale;
 		
 		if ((stepSize > minStep) || (stepSize < -minStep))
@@ -234,6 +237,7 @@ int Math_SmoothStepToI(int* pValue, int target, int scale, int step, int minStep
 	int diff = target - *pValue;
 	
 	if (*pValue != target) {
+		gAnimTick++;
 		stepSize = diff / scale;
 		
 		if ((stepSize > minStep) || (stepSize < -minStep))
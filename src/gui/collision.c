@@ -5,6 +5,8 @@ void TriBuffer_Alloc(TriBuffer* this, u32 num) {
 	this->head = calloc(sizeof(Triangle) * num);
 	this->max = num;
 	this->num = 0;
+	this->block = NULL;
+	this->numBlockTri = 0;
 	
 	osAssert(this->head != NULL);
 }
@@ -12,27 +14,61 @@ void TriBuffer_Alloc(TriBuffer* this, u32 num) {
 void TriBuffer_Realloc(TriBuffer* this) {
 	this->max *= 2;
 	this->head = realloc(this->head, sizeof(Triangle) * this->max);
+	delete(this->block);
+	this->numBlockTri = 0;
 }
 
 void TriBuffer_Free(TriBuffer* this) {
-	delete(this->head);
+	delete(this->head, this->block);
 	memset(this, 0, sizeof(*this));
 }
 
+/**
+ * Builds the SoA blocks used by Col3D_LineVsTriBufferSoA. Has to be called
+ * again after the triangles have been modified.
+ */
+void TriBuffer_Precompute(TriBuffer* this) {
+	u32 numBlock = (this->num + 7) / 8;
+	
+	delete(this->block);
+	this->numBlockTri = 0;
+	
+	if (!numBlock)
+		return;
+	
+	// Padding lanes stay zeroed, degenerate triangles never hit
+	this->block = calloc(sizeof(TriBlock) * numBlock);
+	osAssert(this->block != NULL);
+	
+	for (int i = 0; i < this->num; i++) {
+		Triangle* tri = &this->head[i];
+		TriBlock* block = &this->block[i / 8];
+		s32 l = i % 8;
+		
+		for (int k = 0; k < 3; k++) {
+			block->v0[k][l] = tri->v[0].axis[k];
+			block->e1[k][l] = tri->v[1].axis[k] - tri->v[0].axis[k];
+			block->e2[k][l] = tri->v[2].axis[k] - tri->v[0].axis[k];
+		}
+		block->cullBackface[l] = tri->cullBackface ? -1 : 0;
+		block->cullFrontface[l] = tri->cullFrontface ? -1 : 0;
+	}
+	
+	this->numBlockTri = this->num;
+}
+
 RayLine RayLine_New(Vec3f start, Vec3f end) {
 	return (RayLine) {
 			   start, end, FLT_MAX
 	};
 }
 
-bool Col3D_LineVsTriangle(RayLine* ray, Triangle* tri, Vec3f* outPos, Vec3f* outNor, bool cullBackface, bool cullFrontface) {
+static inline bool Col3D_LineVsTriangleImpl(Vec3f start, Vec3f dir, f32 dist, f32* nearest, Triangle* tri, Vec3f* outPos, Vec3f* outNor, bool cullBackface, bool cullFrontface) {
 	Vec3f vertex0 = tri->v[0];
 	Vec3f vertex1 = tri->v[1];
 	Vec3f vertex2 = tri->v[2];
 	Vec3f edge1, edge2, h, s, q;
 	f32 a, f, u, v;
-	Vec3f dir = Vec3f_Normalize(Vec3f_Sub(ray->end, ray->start));
-	f32 dist = Vec3f_DistXYZ(ray->start, ray->end);
 	
 	edge1 = Vec3f_Sub(vertex1, vertex0);
 	edge2 = Vec3f_Sub(vertex2, vertex0);
@@ -43,7 +79,7 @@ bool Col3D_LineVsTriangle(RayLine* ray, Triangle* tri, Vec3f* outPos, Vec3f* out
 	if (a > -EPSILON && a < EPSILON)
 		return false;          // This ray is parallel to this triangle.
 	f = 1.0 / a;
-	s = Vec3f_Sub(ray->start, vertex0);
+	s = Vec3f_Sub(start, vertex0);
 	u = f * Vec3f_Dot(s, h);
 	if (u < 0.0 || u > 1.0)
 		return false;
@@ -54,47 +90,577 @@ bool Col3D_LineVsTriangle(RayLine* ray, Triangle* tri, Vec3f* outPos, Vec3f* out
 	// At this stage we can compute t to find out where the intersection point is on the line.
 	f32 t = f * Vec3f_Dot(edge2, q);
 	
-	if (t > EPSILON && t < dist && t < ray->nearest) { // ray intersection
+	if (t > EPSILON && t < dist && t < *nearest) { // ray intersection
 		if (outPos)
-			*outPos = Vec3f_Add(ray->start, Vec3f_MulVal(dir, t));
+			*outPos = Vec3f_Add(start, Vec3f_MulVal(dir, t));
 		if (outNor)
 			*outNor = h;
-		ray->nearest = t;
+		*nearest = t;
 		
 		return true;
 	} else                     // This means that there is a line intersection but not a ray intersection.
 		return false;
 }
 
+bool Col3D_LineVsTriangle(RayLine* ray, Triangle* tri, Vec3f* outPos, Vec3f* outNor, bool cullBackface, bool cullFrontface) {
+	Vec3f dir = Vec3f_Normalize(Vec3f_Sub(ray->end, ray->start));
+	f32 dist = Vec3f_DistXYZ(ray->start, ray->end);
+	
+	return Col3D_LineVsTriangleImpl(ray->start, dir, dist, &ray->nearest, tri, outPos, outNor, cullBackface, cullFrontface);
+}
+
+void RayPacket_New(RayPacket* this, RayLine* ray, u32 num) {
+	osAssert(num <= 8);
+	memset(this, 0, sizeof(*this));
+	this->num = num;
+	this->hit -= 1;
+	
+	// Unused lanes keep a zero length and never hit
+	for (int l = 0; l < num; l++) {
+		Vec3f dir = Vec3f_Normalize(Vec3f_Sub(ray[l].end, ray[l].start));
+		
+		for (int k = 0; k < 3; k++) {
+			this->start[k][l] = ray[l].start.axis[k];
+			this->dir[k][l] = dir.axis[k];
+		}
+		this->dist[l] = Vec3f_DistXYZ(ray[l].start, ray[l].end);
+		this->nearest[l] = ray[l].nearest;
+	}
+}
+
+#define CROSS(o, a, b) do { \
+		o[0] = a[1] * b[2] - b[1] * a[2]; \
+		o[1] = a[2] * b[0] - b[2] * a[0]; \
+		o[2] = a[0] * b[1] - b[0] * a[1]; \
+} while (0)
+#define DOT(a, b) (a[0] * b[0] + a[1] * b[1] + a[2] * b[2])
+
+// One line against 8 triangles, returns the lane mask of hits closer than *nearest
+static inline u32 Col3D_LineVsTriBlock(TriBlock* block, f32x8 start[3], f32x8 dir[3], f32 dist, f32 nearest, f32x8* outT, f32x8 outH[3]) {
+	f32x8 h[3], s[3], q[3];
+	f32x8 a, f, u, v, t;
+	s32x8 m;
+	u32 mask = 0;
+	
+	CROSS(h, dir, block->e2);
+	a = DOT(block->e1, h);
+	m = ~((block->cullBackface & (a < 0)) | (block->cullFrontface & (a > 0)));
+	m &= (a <= -EPSILON) | (a >= EPSILON);
+	f = 1.0f / a;
+	for (int k = 0; k < 3; k++)
+		s[k] = start[k] - block->v0[k];
+	u = f * DOT(s, h);
+	m &= (u >= 0.0f) & (u <= 1.0f);
+	CROSS(q, s, block->e1);
+	v = f * DOT(dir, q);
+	m &= (v >= 0.0f) & (u + v <= 1.0f);
+	t = f * DOT(block->e2, q);
+	m &= (t > EPSILON) & (t < dist) & (t < nearest);
+	
+	for (int l = 0; l < 8; l++)
+		mask |= (m[l] & 1) << l;
+	
+	*outT = t;
+	for (int k = 0; k < 3; k++)
+		outH[k] = h[k];
+	
+	return mask;
+}
+
+bool Col3D_LineVsTriBufferSoA(RayLine* ray, TriBuffer* triBuf, Vec3f* outPos, Vec3f* outNor) {
+	Vec3f dir = Vec3f_Normalize(Vec3f_Sub(ray->end, ray->start));
+	f32 dist = Vec3f_DistXYZ(ray->start, ray->end);
+	f32x8 vstart[3], vdir[3];
+	bool r = false;
+	
+	osAssert(triBuf->numBlockTri == triBuf->num);
+	
+	for (int k = 0; k < 3; k++) {
+		vstart[k] = (f32x8) {} + ray->start.axis[k];
+		vdir[k] = (f32x8) {} + dir.axis[k];
+	}
+	
+	for (int i = 0; i < (triBuf->numBlockTri + 7) / 8; i++) {
+		f32x8 t, h[3];
+		u32 mask = Col3D_LineVsTriBlock(&triBuf->block[i], vstart, vdir, dist, ray->nearest, &t, h);
+		s32 best = -1;
+		
+		if (!mask)
+			continue;
+		
+		// Lowest lane with the smallest t, same as testing them one by one
+		for (int l = 0; l < 8; l++)
+			if ((mask & (1 << l)) && (best < 0 || t[l] < t[best]))
+				best = l;
+		
+		ray->nearest = t[best];
+		if (outPos)
+			*outPos = Vec3f_Add(ray->start, Vec3f_MulVal(dir, t[best]));
+		if (outNor)
+			*outNor = Vec3f_New(h[0][best], h[1][best], h[2][best]);
+		r = true;
+	}
+	
+	return r;
+}
+
 bool Col3D_LineVsTriBuffer(RayLine* ray, TriBuffer* triBuf, Vec3f* outPos, Vec3f* outNor) {
+	Vec3f dir = Vec3f_Normalize(Vec3f_Sub(ray->end, ray->start));
+	f32 dist = Vec3f_DistXYZ(ray->start, ray->end);
 	Triangle* tri = triBuf->head;
 	s32 r = 0;
 	
 	for (int i = 0; i < triBuf->num; i++, tri++) {
-		if (Col3D_LineVsTriangle(ray, tri, outPos, outNor, tri->cullBackface, tri->cullFrontface))
+		if (Col3D_LineVsTriangleImpl(ray->start, dir, dist, &ray->nearest, tri, outPos, outNor, tri->cullBackface, tri->cullFrontface))
 			r = true;
 	}
 	
 	return r;
 }
 
-bool Col3D_LineVsCylinder(RayLine* ray, Cylinder* cyl, Vec3f* outPos) {
-	Vec3f rA, rB;
-	Vec3f cA, cB;
+/**
+ * 8 lines against one triangle, for marquee and lasso selection. Lanes that
+ * hit closer than their nearest get it updated and store id in packet->hit.
+ */
+u32 Col3D_LinePacketVsTriangle(RayPacket* packet, Triangle* tri, s32 id, bool cullBackface, bool cullFrontface) {
+	f32x8 e1[3], e2[3], h[3], s[3], q[3];
+	f32x8 a, f, u, v, t;
+	s32x8 m;
+	u32 mask = 0;
+	
+	for (int k = 0; k < 3; k++) {
+		e1[k] = (f32x8) {} + (tri->v[1].axis[k] - tri->v[0].axis[k]);
+		e2[k] = (f32x8) {} + (tri->v[2].axis[k] - tri->v[0].axis[k]);
+		s[k] = packet->start[k] - tri->v[0].axis[k];
+	}
+	
+	CROSS(h, packet->dir, e2);
+	a = DOT(e1, h);
+	m = (a <= -EPSILON) | (a >= EPSILON);
+	if (cullBackface)
+		m &= a >= 0;
+	if (cullFrontface)
+		m &= a <= 0;
+	f = 1.0f / a;
+	u = f * DOT(s, h);
+	m &= (u >= 0.0f) & (u <= 1.0f);
+	CROSS(q, s, e1);
+	v = f * DOT(packet->dir, q);
+	m &= (v >= 0.0f) & (u + v <= 1.0f);
+	t = f * DOT(e2, q);
+	m &= (t > EPSILON) & (t < packet->dist) & (t < packet->nearest);
+	
+	packet->nearest = (f32x8)(((s32x8)t & m) | ((s32x8)packet->nearest & ~m));
+	packet->hit = (id & m) | (packet->hit & ~m);
+	
+	for (int l = 0; l < packet->num; l++)
+		mask |= (m[l] & 1) << l;
+	
+	return mask;
+}
+
+u32 Col3D_LinePacketVsTriBuffer(RayPacket* packet, TriBuffer* triBuf) {
+	Triangle* tri = triBuf->head;
+	u32 mask = 0;
+	
+	for (int i = 0; i < triBuf->num; i++, tri++)
+		mask |= Col3D_LinePacketVsTriangle(packet, tri, i, tri->cullBackface, tri->cullFrontface);
+	
+	return mask;
+}
+
+#undef CROSS
+#undef DOT
+
+/*============================================================================*/
+
+#define BVH_BIN_NUM   12
+#define BVH_LEAF_SIZE 4
+#define BVH_MAX_DEPTH 64
+
+typedef struct {
+	Vec3f min;
+	Vec3f max;
+	u32   num;
+} BVHBin;
+
+typedef struct {
+	Vec3f min;
+	Vec3f max;
+	Vec3f centroid;
+	u32   id;
+} BVHPrim;
+
+static inline void BVH_BoxInit(Vec3f* min, Vec3f* max) {
+	*min = Vec3f_New(FLT_MAX, FLT_MAX, FLT_MAX);
+	*max = Vec3f_New(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+}
+
+static inline void BVH_BoxGrow(Vec3f* min, Vec3f* max, Vec3f p) {
+	for (int i = 0; i < 3; i++) {
+		min->axis[i] = Min(min->axis[i], p.axis[i]);
+		max->axis[i] = Max(max->axis[i], p.axis[i]);
+	}
+}
+
+static inline f32 BVH_BoxArea(Vec3f min, Vec3f max) {
+	Vec3f e = Vec3f_Sub(max, min);
+	
+	if (e.x < 0)
+		return 0.0f;
+	
+	return e.x * e.y + e.y * e.z + e.z * e.x;
+}
+
+static void BVH_NodeBounds(TriBufferBVH* this, BVHNode* node) {
+	BVH_BoxInit(&node->min, &node->max);
+	
+	for (int i = 0; i < node->num; i++) {
+		Triangle* tri = &this->triBuf->head[this->triIndex[node->index + i]];
+		
+		for (int k = 0; k < 3; k++)
+			BVH_BoxGrow(&node->min, &node->max, tri->v[k]);
+	}
+}
+
+// Degenerate or too deep, fall back to an object median split on the longest axis
+static u32 BVH_MedianSplit(BVHNode* node, BVHPrim* prim, Vec3f cmin, Vec3f cmax) {
+	Vec3f ext = Vec3f_Sub(cmax, cmin);
+	s32 axis = ext.x > ext.y ? (ext.x > ext.z ? 0 : 2) : (ext.y > ext.z ? 1 : 2);
+	
+	nested(int, compare, (const void* a, const void* b)) {
+		f32 ca = ((BVHPrim*)a)->centroid.axis[axis];
+		f32 cb = ((BVHPrim*)b)->centroid.axis[axis];
+		
+		return (ca > cb) - (ca < cb);
+	};
+	
+	qsort(prim, node->num, sizeof(BVHPrim), (void*)compare);
+	
+	return node->num / 2;
+}
+
+// Binned SAH split, returns the number of primitives on the left side or 0 for a leaf
+static u32 BVH_Split(BVHNode* node, BVHPrim* prim, bool median) {
+	Vec3f cmin, cmax;
+	f32 bestCost = FLT_MAX;
+	s32 bestAxis = -1;
+	s32 bestBin = 0;
+	
+	BVH_BoxInit(&cmin, &cmax);
+	for (int i = 0; i < node->num; i++)
+		BVH_BoxGrow(&cmin, &cmax, prim[i].centroid);
+	
+	if (median)
+		return BVH_MedianSplit(node, prim, cmin, cmax);
+	
+	for (int axis = 0; axis < 3; axis++) {
+		BVHBin bin[BVH_BIN_NUM];
+		f32 ext = cmax.axis[axis] - cmin.axis[axis];
+		f32 leftArea[BVH_BIN_NUM - 1];
+		u32 leftNum[BVH_BIN_NUM - 1];
+		Vec3f min, max;
+		f32 scale;
+		u32 num = 0;
+		
+		if (ext <= EPSILON)
+			continue;
+		
+		for (int b = 0; b < BVH_BIN_NUM; b++) {
+			BVH_BoxInit(&bin[b].min, &bin[b].max);
+			bin[b].num = 0;
+		}
+		
+		scale = BVH_BIN_NUM / ext;
+		for (int i = 0; i < node->num; i++) {
+			s32 b = (prim[i].centroid.axis[axis] - cmin.axis[axis]) * scale;
+			
+			b = clamp(b, 0, BVH_BIN_NUM - 1);
+			bin[b].num++;
+			BVH_BoxGrow(&bin[b].min, &bin[b].max, prim[i].min);
+			BVH_BoxGrow(&bin[b].min, &bin[b].max, prim[i].max);
+		}
+		
+		BVH_BoxInit(&min, &max);
+		for (int b = 0; b < BVH_BIN_NUM - 1; b++) {
+			num += bin[b].num;
+			if (bin[b].num) {
+				BVH_BoxGrow(&min, &max, bin[b].min);
+				BVH_BoxGrow(&min, &max, bin[b].max);
+			}
+			leftNum[b] = num;
+			leftArea[b] = BVH_BoxArea(min, max);
+		}
+		
+		BVH_BoxInit(&min, &max);
+		num = 0;
+		for (int b = BVH_BIN_NUM - 1; b > 0; b--) {
+			f32 cost;
+			
+			num += bin[b].num;
+			if (bin[b].num) {
+				BVH_BoxGrow(&min, &max, bin[b].min);
+				BVH_BoxGrow(&min, &max, bin[b].max);
+			}
+			
+			if (!leftNum[b - 1] || !num)
+				continue;
+			
+			cost = leftNum[b - 1] * leftArea[b - 1] + num * BVH_BoxArea(min, max);
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestBin = b;
+			}
+		}
+	}
+	
+	if (bestAxis >= 0) {
+		f32 leafCost = node->num * BVH_BoxArea(node->min, node->max);
+		f32 scale = BVH_BIN_NUM / (cmax.axis[bestAxis] - cmin.axis[bestAxis]);
+		s32 i = 0, j = node->num - 1;
+		
+		if (node->num <= BVH_LEAF_SIZE * 4 && bestCost >= leafCost)
+			return 0;
+		
+		// Partition with the same bin mapping used for the cost evaluation
+		while (i <= j) {
+			s32 b = (prim[i].centroid.axis[bestAxis] - cmin.axis[bestAxis]) * scale;
+			
+			if (clamp(b, 0, BVH_BIN_NUM - 1) < bestBin)
+				i++;
+			else {
+				Swap(prim[i], prim[j]);
+				j--;
+			}
+		}
+		
+		if (i > 0 && i < node->num)
+			return i;
+	}
+	
+	return BVH_MedianSplit(node, prim, cmin, cmax);
+}
+
+static void BVH_Subdivide(TriBufferBVH* this, u32 nodeID, BVHPrim* prim, u32 depth) {
+	BVHNode* node = &this->node[nodeID];
+	u32 left, right;
+	u32 split;
+	
+	BVH_BoxInit(&node->min, &node->max);
+	for (int i = 0; i < node->num; i++) {
+		BVH_BoxGrow(&node->min, &node->max, prim[node->index + i].min);
+		BVH_BoxGrow(&node->min, &node->max, prim[node->index + i].max);
+	}
+	
+	if (node->num <= BVH_LEAF_SIZE)
+		return;
+	
+	if (!(split = BVH_Split(node, prim + node->index, depth >= BVH_MAX_DEPTH / 2)))
+		return;
+	
+	left = this->numNode++;
+	this->node[left].index = node->index;
+	this->node[left].num = split;
+	BVH_Subdivide(this, left, prim, depth + 1);
+	
+	right = this->numNode++;
+	node = &this->node[nodeID];
+	this->node[right].index = node->index + split;
+	this->node[right].num = node->num - split;
+	BVH_Subdivide(this, right, prim, depth + 1);
+	
+	node->index = right;
+	node->num = 0;
+}
+
+/**
+ * Initializes this like TriBuffer_Alloc does, TriBufferBVH_Free it before
+ * building it again.
+ */
+void TriBufferBVH_Build(TriBufferBVH* this, TriBuffer* triBuf) {
+	BVHPrim* prim;
+	
+	memset(this, 0, sizeof(*this));
+	this->triBuf = triBuf;
+	this->numTri = triBuf->num;
+	
+	if (!triBuf->num)
+		return;
+	
+	this->triIndex = malloc(sizeof(u32) * triBuf->num);
+	this->node = malloc(sizeof(BVHNode) * (triBuf->num * 2 - 1));
+	prim = malloc(sizeof(BVHPrim) * triBuf->num);
+	osAssert(this->triIndex && this->node && prim);
+	
+	for (int i = 0; i < triBuf->num; i++) {
+		Triangle* tri = &triBuf->head[i];
+		
+		prim[i].id = i;
+		BVH_BoxInit(&prim[i].min, &prim[i].max);
+		for (int k = 0; k < 3; k++)
+			BVH_BoxGrow(&prim[i].min, &prim[i].max, tri->v[k]);
+		prim[i].centroid = Vec3f_MulVal(Vec3f_Add(prim[i].min, prim[i].max), 0.5f);
+	}
+	
+	this->node[0].index = 0;
+	this->node[0].num = triBuf->num;
+	this->numNode = 1;
+	BVH_Subdivide(this, 0, prim, 0);
+	
+	for (int i = 0; i < triBuf->num; i++)
+		this->triIndex[i] = prim[i].id;
+	
+	free(prim);
+}
+
+void TriBufferBVH_Refit(TriBufferBVH* this) {
+	osAssert(this->triBuf == NULL || this->triBuf->num == this->numTri);
+	
+	// Children are always stored after their parent
+	for (s32 i = this->numNode - 1; i >= 0; i--) {
+		BVHNode* node = &this->node[i];
+		
+		if (node->num) {
+			BVH_NodeBounds(this, node);
+		} else {
+			BVHNode* left = &this->node[i + 1];
+			BVHNode* right = &this->node[node->index];
+			
+			node->min = left->min;
+			node->max = left->max;
+			BVH_BoxGrow(&node->min, &node->max, right->min);
+			BVH_BoxGrow(&node->min, &node->max, right->max);
+		}
+	}
+}
+
+void TriBufferBVH_Free(TriBufferBVH* this) {
+	delete(this->node, this->triIndex);
+	memset(this, 0, sizeof(*this));
+}
+
+static inline f32 BVH_RayVsBox(BVHNode* node, Vec3f start, Vec3f invDir, f32 tmax) {
+	f32 tmin = 0.0f;
+	
+	for (int i = 0; i < 3; i++) {
+		// Parallel to this slab, 0 * inf on its boundary would be NaN
+		if (isinf(invDir.axis[i])) {
+			if (start.axis[i] < node->min.axis[i] || start.axis[i] > node->max.axis[i])
+				return FLT_MAX;
+			continue;
+		}
+		
+		f32 t1 = (node->min.axis[i] - start.axis[i]) * invDir.axis[i];
+		f32 t2 = (node->max.axis[i] - start.axis[i]) * invDir.axis[i];
+		
+		tmin = Max(tmin, Min(t1, t2));
+		tmax = Min(tmax, Max(t1, t2));
+	}
+	
+	return tmin <= tmax ? tmin : FLT_MAX;
+}
+
+static bool BVH_Traverse(TriBufferBVH* this, Vec3f start, Vec3f dir, f32 dist, f32* nearest, Vec3f* outPos, Vec3f* outNor) {
+	u32 stack[BVH_MAX_DEPTH];
+	u32 sp = 0;
+	BVHNode* node;
+	Vec3f invDir;
+	bool r = false;
+	
+	if (!this->numNode)
+		return false;
+	
+	for (int i = 0; i < 3; i++)
+		invDir.axis[i] = 1.0f / dir.axis[i];
+	
+	if (BVH_RayVsBox(&this->node[0], start, invDir, fminf(dist, *nearest)) == FLT_MAX)
+		return false;
+	
+	node = &this->node[0];
+	
+	while (true) {
+		if (node->num) {
+			for (int i = 0; i < node->num; i++) {
+				Triangle* tri = &this->triBuf->head[this->triIndex[node->index + i]];
+				
+				if (Col3D_LineVsTriangleImpl(start, dir, dist, nearest, tri, outPos, outNor, tri->cullBackface, tri->cullFrontface))
+					r = true;
+			}
+		} else {
+			BVHNode* a = node + 1;
+			BVHNode* b = &this->node[node->index];
+			f32 tmax = fminf(dist, *nearest);
+			f32 ta = BVH_RayVsBox(a, start, invDir, tmax);
+			f32 tb = BVH_RayVsBox(b, start, invDir, tmax);
+			
+			if (ta > tb) {
+				Swap(a, b);
+				Swap(ta, tb);
+			}
+			
+			if (ta != FLT_MAX) {
+				if (tb != FLT_MAX) {
+					osAssert(sp < BVH_MAX_DEPTH);
+					stack[sp++] = b - this->node;
+				}
+				node = a;
+				continue;
+			}
+		}
+		
+		// Pop until a node that is still in front of the nearest hit
+		while (true) {
+			if (sp == 0)
+				return r;
+			
+			node = &this->node[stack[--sp]];
+			if (BVH_RayVsBox(node, start, invDir, fminf(dist, *nearest)) != FLT_MAX)
+				break;
+		}
+	}
+}
+
+/**
+ * Segment query, same result as Col3D_LineVsTriBuffer.
+ */
+bool Col3D_LineVsTriBufferBVH(RayLine* ray, TriBufferBVH* bvh, Vec3f* outPos, Vec3f* outNor) {
+	Vec3f dir = Vec3f_Normalize(Vec3f_Sub(ray->end, ray->start));
+	f32 dist = Vec3f_DistXYZ(ray->start, ray->end);
+	
+	return BVH_Traverse(bvh, ray->start, dir, dist, &ray->nearest, outPos, outNor);
+}
+
+/**
+ * Ray query, end only gives the direction and the range is limited by ray->nearest.
+ */
+bool Col3D_RayVsTriBufferBVH(RayLine* ray, TriBufferBVH* bvh, Vec3f* outPos, Vec3f* outNor) {
+	Vec3f dir = Vec3f_Normalize(Vec3f_Sub(ray->end, ray->start));
+	
+	return BVH_Traverse(bvh, ray->start, dir, FLT_MAX, &ray->nearest, outPos, outNor);
+}
+
+static void Col3D_CylinderMtx(Cylinder* cyl, MtxF* mtx, MtxF* inv) {
 	Vec3f cyln = Vec3f_LineSegDir(cyl->start, cyl->end);
 	Vec3f up = { 0, 1, 0 };
+	
+	Matrix_MtxFRotateAToB(mtx, &cyln, &up, MTXMODE_NEW);
+	if (inv) {
+		cyln = Vec3f_Invert(cyln);
+		Matrix_MtxFRotateAToB(inv, &cyln, &up, MTXMODE_NEW);
+	}
+}
+
+static bool Col3D_LineVsCylinderImpl(RayLine* ray, Cylinder* cyl, MtxF* mtx, MtxF* inv, Vec3f* outPos) {
+	Vec3f rA, rB;
+	Vec3f cA, cB;
 	Vec3f ip;
 	Vec3f o;
 	
-	Matrix_Push();
-	
-	Matrix_RotateAToB(&cyln, &up, MTXMODE_NEW);
-	Matrix_MultVec3f(&ray->start, &rA);
-	Matrix_MultVec3f(&ray->end, &rB);
-	Matrix_MultVec3f(&cyl->start, &cA);
-	Matrix_MultVec3f(&cyl->end, &cB);
-	
-	Matrix_Pop();
+	Matrix_MultVec3f_Ext(&ray->start, &rA, mtx);
+	Matrix_MultVec3f_Ext(&ray->end, &rB, mtx);
+	Matrix_MultVec3f_Ext(&cyl->start, &cA, mtx);
+	Matrix_MultVec3f_Ext(&cyl->end, &cB, mtx);
 	
 	ip = Vec3f_ClosestPointOnRay(rA, rB, cA, cB);
 	if (ip.y < fminf(cA.y, cB.y) || ip.y > fmaxf(cA.y, cB.y))
@@ -121,16 +687,20 @@ bool Col3D_LineVsCylinder(RayLine* ray, Cylinder* cyl, Vec3f* outPos) {
 		out = o;
 		out.y = ip.y;
 		
-		cyln = Vec3f_Invert(cyln);
-		Matrix_Push();
-		Matrix_RotateAToB(&cyln, &up, MTXMODE_NEW);
-		Matrix_MultVec3f(&out, outPos);
-		Matrix_Pop();
+		Matrix_MultVec3f_Ext(&out, outPos, inv);
 	}
 	
 	return true;
 }
 
+bool Col3D_LineVsCylinder(RayLine* ray, Cylinder* cyl, Vec3f* outPos) {
+	MtxF mtx, inv;
+	
+	Col3D_CylinderMtx(cyl, &mtx, outPos ? &inv : NULL);
+	
+	return Col3D_LineVsCylinderImpl(ray, cyl, &mtx, &inv, outPos);
+}
+
 bool Col3D_LineVsSphere(RayLine* ray, Sphere* sph, Vec3f* outPos) {
 	Vec3f dir = Vec3f_LineSegDir(ray->start, ray->end);
 	f32 rayCylLen = Vec3f_DistXYZ(ray->start, sph->pos);
@@ -150,3 +720,648 @@ bool Col3D_LineVsSphere(RayLine* ray, Sphere* sph, Vec3f* outPos) {
 	
 	return false;
 }
+
+/*============================================================================*/
+
+#define COLWORLD_MAX_CELLS 64
+
+static thread_local u32* sColStamp;
+static thread_local u32 sColStampNum;
+static thread_local u32 sColEpoch;
+
+static inline s32 ColWorld_Coord(ColWorld* this, f32 v) {
+	return (s32)floorf(v / this->cellSize);
+}
+
+static inline u32 ColWorld_Hash(ColWorld* this, s32 x, s32 y, s32 z) {
+	return ((u32)x * 73856093u ^ (u32)y * 19349663u ^ (u32)z * 83492791u) & (this->numBucket - 1);
+}
+
+static inline bool ColWorld_BoxOverlap(Vec3f amin, Vec3f amax, Vec3f bmin, Vec3f bmax) {
+	return amin.x <= bmax.x && amax.x >= bmin.x &&
+	       amin.y <= bmax.y && amax.y >= bmin.y &&
+	       amin.z <= bmax.z && amax.z >= bmin.z;
+}
+
+// Slab test, returns entry distance or FLT_MAX
+static inline f32 ColWorld_LineVsBox(Vec3f min, Vec3f max, Vec3f start, Vec3f invDir, f32 tmax) {
+	BVHNode box = { .min = min, .max = max };
+	
+	return BVH_RayVsBox(&box, start, invDir, tmax);
+}
+
+// Stamps are per thread so queries can run concurrently on a world that is not modified
+static void ColWorld_BeginQuery(ColWorld* this) {
+	if (sColStampNum < this->numShape) {
+		sColStamp = realloc(sColStamp, sizeof(u32) * this->maxShape);
+		memset(sColStamp + sColStampNum, 0, sizeof(u32) * (this->maxShape - sColStampNum));
+		sColStampNum = this->maxShape;
+	}
+	
+	if (++sColEpoch == 0) {
+		memset(sColStamp, 0, sizeof(u32) * sColStampNum);
+		sColEpoch = 1;
+	}
+}
+
+static inline bool ColWorld_Visit(s32 id) {
+	if (sColStamp[id] == sColEpoch)
+		return false;
+	sColStamp[id] = sColEpoch;
+	
+	return true;
+}
+
+static void ColWorld_Rehash(ColWorld* this, u32 numBucket) {
+	this->numBucket = numBucket;
+	this->bucket = realloc(this->bucket, sizeof(s32) * numBucket);
+	memset(this->bucket, 0xFF, sizeof(s32) * numBucket);
+	
+	for (s32 i = 0; i < this->numCell; i++) {
+		ColCell* c = &this->cell[i];
+		u32 h;
+		
+		if (c->shape < 0)
+			continue;
+		
+		h = ColWorld_Hash(this, c->cell[0], c->cell[1], c->cell[2]);
+		c->next = this->bucket[h];
+		this->bucket[h] = i;
+	}
+}
+
+static s32 ColWorld_NewCell(ColWorld* this) {
+	s32 id;
+	
+	if (this->freeCell >= 0) {
+		id = this->freeCell;
+		this->freeCell = this->cell[id].next;
+		
+		return id;
+	}
+	
+	if (this->numCell == this->maxCell) {
+		this->maxCell = Max(this->maxCell * 2, 256);
+		this->cell = realloc(this->cell, sizeof(ColCell) * this->maxCell);
+		osAssert(this->cell != NULL);
+	}
+	
+	return this->numCell++;
+}
+
+static void ColWorld_Link(ColWorld* this, s32 id) {
+	ColShape* sh = &this->shape[id];
+	s64 num = 1;
+	
+	for (int k = 0; k < 3; k++) {
+		sh->cell[0][k] = ColWorld_Coord(this, sh->min.axis[k]);
+		sh->cell[1][k] = ColWorld_Coord(this, sh->max.axis[k]);
+		num *= sh->cell[1][k] - sh->cell[0][k] + 1;
+		
+		this->min.axis[k] = Min(this->min.axis[k], sh->min.axis[k]);
+		this->max.axis[k] = Max(this->max.axis[k], sh->max.axis[k]);
+	}
+	
+	// Shapes spanning many cells are tested on every query instead
+	if ((sh->large = num > COLWORLD_MAX_CELLS || num <= 0)) {
+		if (this->numLarge == this->maxLarge) {
+			this->maxLarge = Max(this->maxLarge * 2, 16);
+			this->large = realloc(this->large, sizeof(s32) * this->maxLarge);
+		}
+		this->large[this->numLarge++] = id;
+		
+		return;
+	}
+	
+	this->maxExtent = Max(this->maxExtent, Vec3f_DistXYZ(sh->min, sh->max));
+	
+	if (this->numUsedCell + num > this->numBucket * 2)
+		ColWorld_Rehash(this, Max(this->numBucket * 2, alignvar(this->numUsedCell + num, 1024) * 2));
+	
+	for (s32 x = sh->cell[0][0]; x <= sh->cell[1][0]; x++) {
+		for (s32 y = sh->cell[0][1]; y <= sh->cell[1][1]; y++) {
+			for (s32 z = sh->cell[0][2]; z <= sh->cell[1][2]; z++) {
+				s32 c = ColWorld_NewCell(this);
+				u32 h = ColWorld_Hash(this, x, y, z);
+				
+				this->cell[c] = (ColCell) { { x, y, z }, id, this->bucket[h] };
+				this->bucket[h] = c;
+			}
+		}
+	}
+	
+	this->numUsedCell += num;
+}
+
+static void ColWorld_Unlink(ColWorld* this, s32 id) {
+	ColShape* sh = &this->shape[id];
+	
+	if (sh->large) {
+		for (int i = 0; i < this->numLarge; i++) {
+			if (this->large[i] == id) {
+				this->large[i] = this->large[--this->numLarge];
+				break;
+			}
+		}
+		
+		return;
+	}
+	
+	for (s32 x = sh->cell[0][0]; x <= sh->cell[1][0]; x++) {
+		for (s32 y = sh->cell[0][1]; y <= sh->cell[1][1]; y++) {
+			for (s32 z = sh->cell[0][2]; z <= sh->cell[1][2]; z++) {
+				s32* link = &this->bucket[ColWorld_Hash(this, x, y, z)];
+				
+				while (*link >= 0) {
+					ColCell* c = &this->cell[*link];
+					
+					if (c->shape == id && c->cell[0] == x && c->cell[1] == y && c->cell[2] == z) {
+						s32 free = *link;
+						
+						*link = c->next;
+						c->shape = -1;
+						c->next = this->freeCell;
+						this->freeCell = free;
+						this->numUsedCell--;
+						break;
+					}
+					
+					link = &c->next;
+				}
+			}
+		}
+	}
+}
+
+static void ColWorld_Bounds(ColShape* sh) {
+	switch (sh->type) {
+		case COLSHAPE_SPHERE:
+			sh->min = Vec3f_Sub(sh->sph.pos, Vec3f_New(sh->sph.r, sh->sph.r, sh->sph.r));
+			sh->max = Vec3f_Add(sh->sph.pos, Vec3f_New(sh->sph.r, sh->sph.r, sh->sph.r));
+			break;
+			
+		case COLSHAPE_CYLINDER:
+			for (int k = 0; k < 3; k++) {
+				sh->min.axis[k] = Min(sh->cyl.start.axis[k], sh->cyl.end.axis[k]) - sh->cyl.r;
+				sh->max.axis[k] = Max(sh->cyl.start.axis[k], sh->cyl.end.axis[k]) + sh->cyl.r;
+			}
+			Col3D_CylinderMtx(&sh->cyl, &sh->mtx, &sh->inv);
+			break;
+			
+		case COLSHAPE_TRIBUF:
+			if (sh->bvh && sh->bvh->numNode) {
+				sh->min = sh->bvh->node[0].min;
+				sh->max = sh->bvh->node[0].max;
+			} else {
+				BVH_BoxInit(&sh->min, &sh->max);
+				for (int i = 0; i < sh->triBuf->num; i++)
+					for (int k = 0; k < 3; k++)
+						BVH_BoxGrow(&sh->min, &sh->max, sh->triBuf->head[i].v[k]);
+			}
+			break;
+			
+		default:
+			break;
+	}
+}
+
+static ColShapeID ColWorld_Add(ColWorld* this, ColShape* shape) {
+	s32 id;
+	
+	if (this->freeShape >= 0) {
+		id = this->freeShape;
+		this->freeShape = this->shape[id].next;
+	} else {
+		if (this->numShape == this->maxShape) {
+			this->maxShape = Max(this->maxShape * 2, 64);
+			this->shape = realloc(this->shape, sizeof(ColShape) * this->maxShape);
+			osAssert(this->shape != NULL);
+		}
+		id = this->numShape++;
+	}
+	
+	this->shape[id] = *shape;
+	this->shape[id].next = -1;
+	ColWorld_Bounds(&this->shape[id]);
+	ColWorld_Link(this, id);
+	
+	return id;
+}
+
+static void ColWorld_Move(ColWorld* this, ColShapeID id) {
+	ColShape* sh = &this->shape[id];
+	s32 old[2][3];
+	bool large = sh->large;
+	
+	memcpy(old, sh->cell, sizeof(old));
+	ColWorld_Bounds(sh);
+	
+	if (!large) {
+		bool same = true;
+		
+		for (int k = 0; k < 3; k++) {
+			if (ColWorld_Coord(this, sh->min.axis[k]) != old[0][k] || ColWorld_Coord(this, sh->max.axis[k]) != old[1][k])
+				same = false;
+			
+			this->min.axis[k] = Min(this->min.axis[k], sh->min.axis[k]);
+			this->max.axis[k] = Max(this->max.axis[k], sh->max.axis[k]);
+		}
+		
+		if (same)
+			return;
+	}
+	
+	memcpy(sh->cell, old, sizeof(old));
+	ColWorld_Unlink(this, id);
+	ColWorld_Link(this, id);
+}
+
+void ColWorld_Init(ColWorld* this, f32 cellSize) {
+	memset(this, 0, sizeof(*this));
+	osAssert(cellSize > 0.0f);
+	
+	this->cellSize = cellSize;
+	this->freeShape = -1;
+	this->freeCell = -1;
+	BVH_BoxInit(&this->min, &this->max);
+	ColWorld_Rehash(this, 1024);
+}
+
+void ColWorld_Free(ColWorld* this) {
+	delete(this->shape, this->cell, this->bucket, this->large);
+	memset(this, 0, sizeof(*this));
+}
+
+ColShapeID ColWorld_AddSphere(ColWorld* this, Sphere* sph, void* udata) {
+	return ColWorld_Add(this, &(ColShape) { .type = COLSHAPE_SPHERE, .sph = *sph, .udata = udata });
+}
+
+ColShapeID ColWorld_AddCylinder(ColWorld* this, Cylinder* cyl, void* udata) {
+	return ColWorld_Add(this, &(ColShape) { .type = COLSHAPE_CYLINDER, .cyl = *cyl, .udata = udata });
+}
+
+/**
+ * The TriBuffer and optional BVH are referenced, not copied. Call
+ * ColWorld_UpdateTriBuffer after modifying or refitting them.
+ */
+ColShapeID ColWorld_AddTriBuffer(ColWorld* this, TriBuffer* triBuf, TriBufferBVH* bvh, void* udata) {
+	return ColWorld_Add(this, &(ColShape) { .type = COLSHAPE_TRIBUF, .triBuf = triBuf, .bvh = bvh, .udata = udata });
+}
+
+void ColWorld_MoveSphere(ColWorld* this, ColShapeID id, Sphere* sph) {
+	osAssert(this->shape[id].type == COLSHAPE_SPHERE);
+	this->shape[id].sph = *sph;
+	ColWorld_Move(this, id);
+}
+
+void ColWorld_MoveCylinder(ColWorld* this, ColShapeID id, Cylinder* cyl) {
+	osAssert(this->shape[id].type == COLSHAPE_CYLINDER);
+	this->shape[id].cyl = *cyl;
+	ColWorld_Move(this, id);
+}
+
+void ColWorld_UpdateTriBuffer(ColWorld* this, ColShapeID id) {
+	osAssert(this->shape[id].type == COLSHAPE_TRIBUF);
+	ColWorld_Move(this, id);
+}
+
+void ColWorld_Remove(ColWorld* this, ColShapeID id) {
+	ColShape* sh = &this->shape[id];
+	
+	osAssert(sh->type != COLSHAPE_NONE);
+	ColWorld_Unlink(this, id);
+	sh->type = COLSHAPE_NONE;
+	sh->next = this->freeShape;
+	this->freeShape = id;
+}
+
+ColShape* ColWorld_Get(ColWorld* this, ColShapeID id) {
+	if (id < 0 || id >= this->numShape || this->shape[id].type == COLSHAPE_NONE)
+		return NULL;
+	
+	return &this->shape[id];
+}
+
+static bool ColWorld_LineVsShape(ColShape* sh, RayLine* ray, Vec3f* outPos, Vec3f* outNor) {
+	Vec3f pos, nor;
+	bool r = false;
+	
+	switch (sh->type) {
+		case COLSHAPE_SPHERE:
+			if ((r = Col3D_LineVsSphere(ray, &sh->sph, &pos)))
+				nor = Vec3f_LineSegDir(sh->sph.pos, pos);
+			break;
+			
+		case COLSHAPE_CYLINDER:
+			if ((r = Col3D_LineVsCylinderImpl(ray, &sh->cyl, &sh->mtx, &sh->inv, &pos)))
+				nor = Vec3f_LineSegDir(Vec3f_ProjectAlong(pos, sh->cyl.start, sh->cyl.end), pos);
+			break;
+			
+		case COLSHAPE_TRIBUF:
+			if (sh->bvh)
+				r = Col3D_LineVsTriBufferBVH(ray, sh->bvh, &pos, &nor);
+			else
+				r = Col3D_LineVsTriBuffer(ray, sh->triBuf, &pos, &nor);
+			break;
+			
+		default:
+			break;
+	}
+	
+	if (r) {
+		if (outPos)
+			*outPos = pos;
+		if (outNor)
+			*outNor = nor;
+	}
+	
+	return r;
+}
+
+static ColShapeID ColWorld_Trace(ColWorld* this, RayLine* ray, Vec3f* outPos, Vec3f* outNor) {
+	Vec3f dir = Vec3f_LineSegDir(ray->start, ray->end);
+	f32 len = Vec3f_DistXYZ(ray->start, ray->end);
+	Vec3f invDir;
+	ColShapeID hit = -1;
+	s32 cell[3], step[3];
+	f32 tNext[3], tDelta[3];
+	f32 t0, t1;
+	
+	for (int k = 0; k < 3; k++)
+		invDir.axis[k] = 1.0f / dir.axis[k];
+	
+	ColWorld_BeginQuery(this);
+	
+	for (int i = 0; i < this->numLarge; i++) {
+		ColShape* sh = &this->shape[this->large[i]];
+		
+		if (ColWorld_LineVsBox(sh->min, sh->max, ray->start, invDir, len) == FLT_MAX)
+			continue;
+		if (ColWorld_LineVsShape(sh, ray, outPos, outNor))
+			hit = this->large[i];
+	}
+	
+	if ((t0 = ColWorld_LineVsBox(this->min, this->max, ray->start, invDir, len)) == FLT_MAX)
+		return hit;
+	
+	// Exit distance of the world bounds
+	t1 = len;
+	for (int k = 0; k < 3; k++) {
+		f32 a = (this->min.axis[k] - ray->start.axis[k]) * invDir.axis[k];
+		f32 b = (this->max.axis[k] - ray->start.axis[k]) * invDir.axis[k];
+		
+		if (a == a && b == b)
+			t1 = Min(t1, Max(a, b));
+	}
+	
+	for (int k = 0; k < 3; k++) {
+		f32 p = ray->start.axis[k] + dir.axis[k] * t0;
+		
+		cell[k] = ColWorld_Coord(this, p);
+		cell[k] = clamp(cell[k], ColWorld_Coord(this, this->min.axis[k]), ColWorld_Coord(this, this->max.axis[k]));
+		
+		if (dir.axis[k] > 0) {
+			step[k] = 1;
+			tDelta[k] = this->cellSize * invDir.axis[k];
+			tNext[k] = ((cell[k] + 1) * this->cellSize - ray->start.axis[k]) * invDir.axis[k];
+		} else if (dir.axis[k] < 0) {
+			step[k] = -1;
+			tDelta[k] = -this->cellSize * invDir.axis[k];
+			tNext[k] = (cell[k] * this->cellSize - ray->start.axis[k]) * invDir.axis[k];
+		} else {
+			step[k] = 0;
+			tDelta[k] = FLT_MAX;
+			tNext[k] = FLT_MAX;
+		}
+	}
+	
+	// Walk the cells along the line, a shape can extend at most maxExtent
+	// in front of the cell it is found in, so stop once nothing can be closer
+	while (t0 <= t1 && t0 <= ray->nearest + this->maxExtent) {
+		s32 k;
+		
+		for (s32 c = this->bucket[ColWorld_Hash(this, cell[0], cell[1], cell[2])]; c >= 0; c = this->cell[c].next) {
+			ColCell* cc = &this->cell[c];
+			ColShape* sh;
+			
+			if (cc->cell[0] != cell[0] || cc->cell[1] != cell[1] || cc->cell[2] != cell[2])
+				continue;
+			if (!ColWorld_Visit(cc->shape))
+				continue;
+			
+			sh = &this->shape[cc->shape];
+			if (ColWorld_LineVsBox(sh->min, sh->max, ray->start, invDir, len) == FLT_MAX)
+				continue;
+			if (ColWorld_LineVsShape(sh, ray, outPos, outNor))
+				hit = cc->shape;
+		}
+		
+		k = tNext[0] < tNext[1] ? (tNext[0] < tNext[2] ? 0 : 2) : (tNext[1] < tNext[2] ? 1 : 2);
+		t0 = tNext[k];
+		tNext[k] += tDelta[k];
+		cell[k] += step[k];
+	}
+	
+	return hit;
+}
+
+/**
+ * Segment query, only shapes overlapping the segment are tested. Returns
+ * the nearest shape or -1, ray->nearest is updated like Col3D_* does.
+ */
+ColShapeID ColWorld_LineTest(ColWorld* this, RayLine* ray, Vec3f* outPos, Vec3f* outNor) {
+	return ColWorld_Trace(this, ray, outPos, outNor);
+}
+
+/**
+ * Ray query, end only gives the direction.
+ */
+ColShapeID ColWorld_RayTest(ColWorld* this, RayLine* ray, Vec3f* outPos, Vec3f* outNor) {
+	Vec3f dir = Vec3f_LineSegDir(ray->start, ray->end);
+	f32 len = 0.0f;
+	RayLine r;
+	ColShapeID hit;
+	
+	for (int k = 0; k < 3; k++) {
+		len = Max(len, fabsf(this->min.axis[k] - ray->start.axis[k]));
+		len = Max(len, fabsf(this->max.axis[k] - ray->start.axis[k]));
+	}
+	
+	r = *ray;
+	r.end = Vec3f_Add(ray->start, Vec3f_MulVal(dir, len * 2.0f + 1.0f));
+	hit = ColWorld_Trace(this, &r, outPos, outNor);
+	ray->nearest = r.nearest;
+	
+	return hit;
+}
+
+static Vec3f Col3D_ClosestPointOnTriangle(Vec3f p, Triangle* tri) {
+	Vec3f a = tri->v[0], b = tri->v[1], c = tri->v[2];
+	Vec3f ab = Vec3f_Sub(b, a), ac = Vec3f_Sub(c, a), ap = Vec3f_Sub(p, a);
+	f32 d1 = Vec3f_Dot(ab, ap), d2 = Vec3f_Dot(ac, ap);
+	
+	if (d1 <= 0.0f && d2 <= 0.0f)
+		return a;
+	
+	Vec3f bp = Vec3f_Sub(p, b);
+	f32 d3 = Vec3f_Dot(ab, bp), d4 = Vec3f_Dot(ac, bp);
+	
+	if (d3 >= 0.0f && d4 <= d3)
+		return b;
+	
+	f32 vc = d1 * d4 - d3 * d2;
+	
+	if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+		return Vec3f_Add(a, Vec3f_MulVal(ab, d1 / (d1 - d3)));
+	
+	Vec3f cp = Vec3f_Sub(p, c);
+	f32 d5 = Vec3f_Dot(ab, cp), d6 = Vec3f_Dot(ac, cp);
+	
+	if (d6 >= 0.0f && d5 <= d6)
+		return c;
+	
+	f32 vb = d5 * d2 - d1 * d6;
+	
+	if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+		return Vec3f_Add(a, Vec3f_MulVal(ac, d2 / (d2 - d6)));
+	
+	f32 va = d3 * d6 - d5 * d4;
+	
+	if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+		return Vec3f_Add(b, Vec3f_MulVal(Vec3f_Sub(c, b), (d4 - d3) / ((d4 - d3) + (d5 - d6))));
+	
+	f32 denom = 1.0f / (va + vb + vc);
+	
+	return Vec3f_Add(a, Vec3f_Add(Vec3f_MulVal(ab, vb * denom), Vec3f_MulVal(ac, vc * denom)));
+}
+
+static bool ColWorld_SphereVsTriBuffer(ColShape* sh, Sphere* sph, Vec3f min, Vec3f max) {
+	f32 r2 = SQ(sph->r);
+	
+	if (sh->bvh && sh->bvh->numNode) {
+		TriBufferBVH* bvh = sh->bvh;
+		u32 stack[BVH_MAX_DEPTH];
+		u32 sp = 0;
+		
+		stack[sp++] = 0;
+		while (sp) {
+			BVHNode* node = &bvh->node[stack[--sp]];
+			
+			if (!ColWorld_BoxOverlap(node->min, node->max, min, max))
+				continue;
+			
+			if (!node->num) {
+				stack[sp++] = node - bvh->node + 1;
+				stack[sp++] = node->index;
+				continue;
+			}
+			
+			for (int i = 0; i < node->num; i++) {
+				Triangle* tri = &bvh->triBuf->head[bvh->triIndex[node->index + i]];
+				
+				if (Vec3f_MagnitudeSQ(Vec3f_Sub(Col3D_ClosestPointOnTriangle(sph->pos, tri), sph->pos)) < r2)
+					return true;
+			}
+		}
+		
+		return false;
+	}
+	
+	for (int i = 0; i < sh->triBuf->num; i++)
+		if (Vec3f_MagnitudeSQ(Vec3f_Sub(Col3D_ClosestPointOnTriangle(sph->pos, &sh->triBuf->head[i]), sph->pos)) < r2)
+			return true;
+	
+	return false;
+}
+
+// Cylinders are treated as capsules here
+static bool ColWorld_SphereVsShape(ColShape* sh, Sphere* sph, Vec3f min, Vec3f max) {
+	if (!ColWorld_BoxOverlap(sh->min, sh->max, min, max))
+		return false;
+	
+	switch (sh->type) {
+		case COLSHAPE_SPHERE:
+			return Vec3f_DistXYZ(sh->sph.pos, sph->pos) < sh->sph.r + sph->r;
+			
+		case COLSHAPE_CYLINDER: {
+			Vec3f ab = Vec3f_Sub(sh->cyl.end, sh->cyl.start);
+			f32 len = Vec3f_MagnitudeSQ(ab);
+			f32 t = len > 0.0f ? Vec3f_Dot(Vec3f_Sub(sph->pos, sh->cyl.start), ab) / len : 0.0f;
+			Vec3f p = Vec3f_Add(sh->cyl.start, Vec3f_MulVal(ab, clamp(t, 0.0f, 1.0f)));
+			
+			return Vec3f_DistXYZ(p, sph->pos) < sh->cyl.r + sph->r;
+		}
+		
+		case COLSHAPE_TRIBUF:
+			return ColWorld_SphereVsTriBuffer(sh, sph, min, max);
+			
+		default:
+			return false;
+	}
+}
+
+/**
+ * Adds the ColShapeID of every shape overlapping the sphere to out,
+ * returns the number of shapes added.
+ */
+u32 ColWorld_Overlap(ColWorld* this, Sphere* sph, Arli* out) {
+	Vec3f r = Vec3f_New(sph->r, sph->r, sph->r);
+	Vec3f min = Vec3f_Sub(sph->pos, r);
+	Vec3f max = Vec3f_Add(sph->pos, r);
+	s32 c0[3], c1[3];
+	s64 num = 1;
+	u32 found = 0;
+	
+	ColWorld_BeginQuery(this);
+	
+	for (int i = 0; i < this->numLarge; i++) {
+		if (ColWorld_SphereVsShape(&this->shape[this->large[i]], sph, min, max)) {
+			Arli_Add(out, &this->large[i]);
+			found++;
+		}
+	}
+	
+	for (int k = 0; k < 3; k++) {
+		c0[k] = ColWorld_Coord(this, Max(min.axis[k], this->min.axis[k]));
+		c1[k] = ColWorld_Coord(this, Min(max.axis[k], this->max.axis[k]));
+		num *= Max(c1[k] - c0[k] + 1, 0);
+	}
+	
+	// Cheaper to go through the shapes directly than through that many cells
+	if (num > this->numShape) {
+		for (s32 i = 0; i < this->numShape; i++) {
+			ColShape* sh = &this->shape[i];
+			
+			if (sh->type == COLSHAPE_NONE || sh->large)
+				continue;
+			if (ColWorld_SphereVsShape(sh, sph, min, max)) {
+				Arli_Add(out, &i);
+				found++;
+			}
+		}
+		
+		return found;
+	}
+	
+	for (s32 x = c0[0]; x <= c1[0]; x++) {
+		for (s32 y = c0[1]; y <= c1[1]; y++) {
+			for (s32 z = c0[2]; z <= c1[2]; z++) {
+				for (s32 c = this->bucket[ColWorld_Hash(this, x, y, z)]; c >= 0; c = this->cell[c].next) {
+					ColCell* cc = &this->cell[c];
+					
+					if (cc->cell[0] != x || cc->cell[1] != y || cc->cell[2] != z)
+						continue;
+					if (!ColWorld_Visit(cc->shape))
+						continue;
+					
+					if (ColWorld_SphereVsShape(&this->shape[cc->shape], sph, min, max)) {
+						Arli_Add(out, &cc->shape);
+						found++;
+					}
+				}
+			}
+		}
+	}
+	
+	return found;
+}
@@ -116,6 +116,20 @@ void Input_End(Input* this) {
 		this->buffer[i++] = '\0';
 }
 
+// Held keys and buttons, or timers still counting frames
+bool Input_IsActive(Input* this) {
+	Cursor* cursor = &this->cursor;
+	
+	if (this->keyAction || cursor->clickAny.hold || this->tempLock)
+		return true;
+	
+	for (int i = 0; i < CLICK_ANY; i++)
+		if (cursor->clickList[i].__timer)
+			return true;
+	
+	return false;
+}
+
 const char* Input_GetClipboardStr(Input* this) {
 	return glfwGetClipboardString(this->window->glfw);
 }
@@ -215,11 +229,13 @@ void InputCallback_Key(GLFWwindow* window, s32 key, s32 scancode, s32 action, s3
 	Input* this = GET_WINDOW()->input;
 	
 	this->key[key].hold = action != 0;
+	Window_RequestRedraw(this->window);
 }
 
 void InputCallback_Text(GLFWwindow* window, u32 scancode) {
 	Input* this = GET_WINDOW()->input;
 	
+	Window_RequestRedraw(this->window);
 	if (!(scancode & 0xFFFFFF00)) {
 		if (scancode > 0x7F) {
 			printf("\a");
@@ -233,6 +249,7 @@ void InputCallback_Mouse(GLFWwindow* window, s32 button, s32 action, s32 mods) {
 	Input* this = GET_WINDOW()->input;
 	Cursor* cursor = &this->cursor;
 	
+	Window_RequestRedraw(this->window);
 	switch (button) {
 		case GLFW_MOUSE_BUTTON_RIGHT:
 			cursor->clickR.hold = action != 0;
@@ -247,6 +264,8 @@ void InputCallback_Mouse(GLFWwindow* window, s32 button, s32 action, s32 mods) {
 }
 
 void InputCallback_MousePos(GLFWwindow* window, f64 x, f64 y) {
+	Window_RequestRedraw(GET_WINDOW());
+	
 	// Input* input = GET_WINDOW()->input;
 	// Cursor* cursor = &input->cursor;
 	
@@ -260,5 +279,6 @@ void InputCallback_Scroll(GLFWwindow* window, f64 x, f64 y) {
 	Input* this = GET_WINDOW()->input;
 	Cursor* cursor = &this->cursor;
 	
+	Window_RequestRedraw(this->window);
 	cursor->scrollY += y;
 }
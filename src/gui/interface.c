@@ -9,6 +9,8 @@ f32 gPixelRatio = 1.0f;
 f32 gPixelScale = 1.0f;
 const f64 gNativeFPS = 60;
 
+#define WINDOW_IDLE_WAIT 0.5 // Seconds between updates while nothing happens
+
 extern DataFile gHack;
 extern DataFile gHackBold;
 void (*gUiInitFunc)();
@@ -23,6 +25,7 @@ static void Update(Window* this) {
 	}
 	
 	if (!glfwGetWindowAttrib(this->glfw, GLFW_ICONIFIED)) {
+		bool redraw = this->state & APP_RESIZE_CALLBACK;
 		s32 winWidth, winHeight;
 		s32 fbWidth, fbHeight;
 		
@@ -31,13 +34,17 @@ static void Update(Window* this) {
 		
 		gPixelRatio = (float)fbWidth / (float)winWidth;
 		
+		redraw |= __atomic_exchange_n(&this->private.redraw, false, __ATOMIC_ACQ_REL);
 		Input_Update(this->input);
 		this->updateCall(this->context);
 		
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-		glViewport(0, 0, winWidth, winHeight);
-		this->drawCall(this->context);
-		glfwSwapBuffers(this->glfw);
+		// Nothing changed, the last frame stays on screen
+		if (redraw || __atomic_load_n(&this->private.redraw, __ATOMIC_ACQUIRE)) {
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+			glViewport(0, 0, winWidth, winHeight);
+			this->drawCall(this->context);
+			glfwSwapBuffers(this->glfw);
+		}
 		
 		Input_End(this->input);
 	}
@@ -57,6 +64,10 @@ static void Window_FramebufferCallback(GLFWwindow* glfw, s32 width, s32 height)
 	Update(this);
 }
 
+static void Window_RefreshCallback(GLFWwindow* glfw) {
+	Window_RequestRedraw(glfwGetWindowUserPointer(glfw));
+}
+
 GLFWwindow* GET_GLFWWINDOW(void) {
 	return glfwGetCurrentContext();
 }
@@ -98,6 +109,7 @@ void* Window_Init(const char* title, Window* this, Input* input, void* context,
 	this->drawCall = drawCall;
 	this->dim.x = x;
 	this->dim.y = y;
+	this->private.redraw = true;
 	
 	glfwInit();
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
@@ -121,6 +133,7 @@ void* Window_Init(const char* title, Window* this, Input* input, void* context,
 	osLog("Set Callbacks");
 	glfwMakeContextCurrent(this->glfw);
 	glfwSetFramebufferSizeCallback(this->glfw, Window_FramebufferCallback);
+	glfwSetWindowRefreshCallback(this->glfw, Window_RefreshCallback);
 	glfwSetMouseButtonCallback(this->glfw, InputCallback_Mouse);
 	glfwSetCursorPosCallback(this->glfw, InputCallback_MousePos);
 	glfwSetKeyCallback(this->glfw, InputCallback_Key);
@@ -160,9 +173,51 @@ void Window_Close(Window* this) {
 	glfwSetWindowShouldClose(this->glfw, GLFW_TRUE);
 }
 
+/**
+ * Thread safe, wakes the window if it is idling. Input, resizes and
+ * running animations request frames on their own.
+ */
+void Window_RequestRedraw(Window* this) {
+	if (__atomic_exchange_n(&this->private.redraw, true, __ATOMIC_ACQ_REL))
+		return;
+	
+	glfwPostEmptyEvent();
+}
+
+// Caps frames per second on top of vsync, 0 removes the cap
+void Window_SetFrameCap(Window* this, f32 fps) {
+	this->maxFPS = fps;
+}
+
+/**
+ * Blocks until input arrives when no frame was requested. Otherwise waits
+ * out the frame cap while still handling events.
+ */
+static void Window_Wait(Window* this) {
+	if (!__atomic_load_n(&this->private.redraw, __ATOMIC_ACQUIRE)) {
+		glfwWaitEventsTimeout(WINDOW_IDLE_WAIT);
+		
+		return;
+	}
+	
+	if (this->maxFPS > 0) {
+		f64 next = this->private.frameTime + 1.0 / this->maxFPS;
+		f64 now;
+		
+		while ((now = glfwGetTime()) < next)
+			glfwWaitEventsTimeout(next - now);
+	}
+	
+	this->private.frameTime = glfwGetTime();
+	glfwPollEvents();
+}
+
 void Window_Update(Window* this) {
 	while (!(this->state & APP_CLOSED)) {
 		if (!glfwWindowShouldClose(this->glfw)) {
+			u32 anim = gAnimTick;
+			bool idle;
+			
 			glfwMakeContextCurrent(this->glfw);
 			time_start(0xF0);
 			this->private.tickMod += gDeltaTime;
@@ -172,8 +227,15 @@ void Window_Update(Window* this) {
 			} else this->tick = false;
 			
 			Update(this);
-			glfwPollEvents();
-			gDeltaTime = time_get(0xF0) / (1.0 / gNativeFPS);
+			
+			if (gAnimTick != anim || Input_IsActive(this->input))
+				__atomic_store_n(&this->private.redraw, true, __ATOMIC_RELEASE);
+			
+			idle = !__atomic_load_n(&this->private.redraw, __ATOMIC_ACQUIRE);
+			Window_Wait(this);
+			
+			// Animations resume at a normal step after idling
+			gDeltaTime = idle ? 1.0f : time_get(0xF0) / (1.0 / gNativeFPS);
 		} else {
 			osLog("Close Window: [%s]", this->title);
 			this->state |= APP_CLOSED;
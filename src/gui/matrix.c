@@ -3,8 +3,12 @@
 #define    FTOFIX32(x) (long)((x) * (float)0x00010000)
 #define    FIX32TOF(x) ((float)(x) * (1.0f / (float)0x00010000))
 
-MtxF* gMatrixStack;
-MtxF* gCurrentMatrix;
+thread_local MtxF* gMatrixStack;
+thread_local MtxF* gCurrentMatrix;
+static thread_local MtxF* sMatrixStackEnd;
+static u32 sMatrixStackDepth = 20;
+static pthread_key_t sMatrixKey;
+static pthread_once_t sMatrixKeyOnce = PTHREAD_ONCE_INIT;
 const MtxF gMtxFClear = {
 	1.0f, 0.0f, 0.0f, 0.0f,
 	0.0f, 1.0f, 0.0f, 0.0f,
@@ -12,11 +16,49 @@ const MtxF gMtxFClear = {
 	0.0f, 0.0f, 0.0f, 1.0f,
 };
 
+static void Matrix_KeyDest(void* stack) {
+	free(stack);
+}
+
+static void Matrix_KeyInit(void) {
+	pthread_key_create(&sMatrixKey, Matrix_KeyDest);
+}
+
+// Depth of stacks created after this call, already existing stacks are kept as is
+void Matrix_SetStackDepth(u32 depth) {
+	osAssert(depth > 0);
+	sMatrixStackDepth = depth;
+}
+
+// Every thread owns its own stack, allocated on first use and freed on thread exit
 void Matrix_Init() {
 	if (gCurrentMatrix)
 		return;
-	gCurrentMatrix = calloc(20 * sizeof(MtxF));
+	pthread_once(&sMatrixKeyOnce, Matrix_KeyInit);
+	
+	gCurrentMatrix = calloc(sMatrixStackDepth * sizeof(MtxF));
+	osAssert(gCurrentMatrix != NULL);
 	gMatrixStack = gCurrentMatrix;
+	sMatrixStackEnd = gMatrixStack + sMatrixStackDepth;
+	Matrix_Clear(gCurrentMatrix);
+	
+	pthread_setspecific(sMatrixKey, gMatrixStack);
+}
+
+void Matrix_Free(void) {
+	if (!gMatrixStack)
+		return;
+	
+	pthread_setspecific(sMatrixKey, NULL);
+	free(gMatrixStack);
+	gMatrixStack = gCurrentMatrix = sMatrixStackEnd = NULL;
+}
+
+static inline MtxF* Matrix_Current(void) {
+	if (!gCurrentMatrix)
+		Matrix_Init();
+	
+	return gCurrentMatrix;
 }
 
 void Matrix_Clear(MtxF* mf) {
@@ -39,31 +81,39 @@ void Matrix_Clear(MtxF* mf) {
 }
 
 void Matrix_Push(void) {
-	Matrix_MtxFCopy(gCurrentMatrix + 1, gCurrentMatrix);
+	MtxF* cmf = Matrix_Current();
+	
+	if (cmf + 1 >= sMatrixStackEnd)
+		errr("Matrix_Push: stack overflow, depth %d", sMatrixStackDepth);
+	
+	Matrix_MtxFCopy(cmf + 1, cmf);
 	gCurrentMatrix++;
 }
 
 void Matrix_Pop(void) {
+	if (gCurrentMatrix == NULL || gCurrentMatrix <= gMatrixStack)
+		errr("Matrix_Pop: stack underflow");
+	
 	gCurrentMatrix--;
 }
 
 void Matrix_Get(MtxF* dest) {
 	osAssert(dest != NULL);
-	Matrix_MtxFCopy(dest, gCurrentMatrix);
+	Matrix_MtxFCopy(dest, Matrix_Current());
 }
 
 void Matrix_Put(MtxF* src) {
 	osAssert(src != NULL);
-	Matrix_MtxFCopy(gCurrentMatrix, src);
+	Matrix_MtxFCopy(Matrix_Current(), src);
 }
 
 void Matrix_Mult(MtxF* mf, MtxMode mode) {
-	MtxF* cmf = gCurrentMatrix;
+	MtxF* cmf = Matrix_Current();
 	
 	if (mode == MTXMODE_APPLY) {
 		Matrix_MtxFMtxFMult(cmf, mf, cmf);
 	} else {
-		Matrix_MtxFCopy(gCurrentMatrix, mf);
+		Matrix_MtxFCopy(Matrix_Current(), mf);
 	}
 }
 
@@ -87,7 +137,7 @@ void Matrix_MultVec3fToVec4f_Ext(Vec3f* src, Vec4f* dest, MtxF* mf) {
 }
 
 void Matrix_MultVec3f(Vec3f* src, Vec3f* dest) {
-	MtxF* cmf = gCurrentMatrix;
+	MtxF* cmf = Matrix_Current();
 	
 	dest->x = cmf->xw + (cmf->xx * src->x + cmf->xy * src->y + cmf->xz * src->z);
 	dest->y = cmf->yw + (cmf->yx * src->x + cmf->yy * src->y + cmf->yz * src->z);
@@ -148,11 +198,11 @@ void Matrix_MtxFTranslate(MtxF* cmf, f32 x, f32 y, f32 z, MtxMode mode) {
 }
 
 void Matrix_Translate(f32 x, f32 y, f32 z, MtxMode mode) {
-	Matrix_MtxFTranslate(gCurrentMatrix, x, y, z, mode);
+	Matrix_MtxFTranslate(Matrix_Current(), x, y, z, mode);
 }
 
 void Matrix_Scale(f32 x, f32 y, f32 z, MtxMode mode) {
-	MtxF* cmf = gCurrentMatrix;
+	MtxF* cmf = Matrix_Current();
 	
 	if (mode == MTXMODE_APPLY) {
 		cmf->xx *= x;
@@ -196,7 +246,7 @@ void Matrix_RotateX(f32 x, MtxMode mode) {
 	
 	if (mode == MTXMODE_APPLY) {
 		if (x != 0) {
-			cmf = gCurrentMatrix;
+			cmf = Matrix_Current();
 			
 			sin = sinf(x);
 			cos = cosf(x);
@@ -222,7 +272,7 @@ void Matrix_RotateX(f32 x, MtxMode mode) {
 			cmf->wz = temp2 * cos - temp1 * sin;
 		}
 	} else {
-		cmf = gCurrentMatrix;
+		cmf = Matrix_Current();
 		
 		if (x != 0) {
 			sin = sinf(x);
@@ -260,7 +310,7 @@ void Matrix_RotateY(f32 y, MtxMode mode) {
 	
 	if (mode == MTXMODE_APPLY) {
 		if (y != 0) {
-			cmf = gCurrentMatrix;
+			cmf = Matrix_Current();
 			
 			sin = sinf(y);
 			cos = cosf(y);
@@ -286,7 +336,7 @@ void Matrix_RotateY(f32 y, MtxMode mode) {
 			cmf->wz = temp1 * sin + temp2 * cos;
 		}
 	} else {
-		cmf = gCurrentMatrix;
+		cmf = Matrix_Current();
 		
 		if (y != 0) {
 			sin = sinf(y);
@@ -324,7 +374,7 @@ void Matrix_RotateZ(f32 z, MtxMode mode) {
 	
 	if (mode == MTXMODE_APPLY) {
 		if (z != 0) {
-			cmf = gCurrentMatrix;
+			cmf = Matrix_Current();
 			
 			sin = sinf(z);
 			cos = cosf(z);
@@ -350,7 +400,7 @@ void Matrix_RotateZ(f32 z, MtxMode mode) {
 			cmf->wy = temp2 * cos - temp1 * sin;
 		}
 	} else {
-		cmf = gCurrentMatrix;
+		cmf = Matrix_Current();
 		
 		if (z != 0) {
 			sin = sinf(z);
@@ -415,7 +465,7 @@ void Matrix_MtxFCopy(MtxF* dest, MtxF* src) {
 }
 
 void Matrix_ToMtxF(MtxF* mtx) {
-	Matrix_MtxFCopy(mtx, gCurrentMatrix);
+	Matrix_MtxFCopy(mtx, Matrix_Current());
 }
 
 void Matrix_MtxToMtxF(Mtx* src, MtxF* dest) {
@@ -513,7 +563,7 @@ Mtx* Matrix_MtxFToMtx(MtxF* src, Mtx* dest) {
 }
 
 Mtx* Matrix_ToMtx(Mtx* dest) {
-	return Matrix_MtxFToMtx(gCurrentMatrix, dest);
+	return Matrix_MtxFToMtx(Matrix_Current(), dest);
 }
 
 Mtx* Matrix_NewMtx() {
@@ -829,10 +879,10 @@ void Matrix_MtxFTranslateRotateZYX(MtxF* cmf, Vec3f* translation, Vec3s* rotatio
 }
 
 void Matrix_TranslateRotateZYX(Vec3f* translation, Vec3s* rotation) {
-	Matrix_MtxFTranslateRotateZYX(gCurrentMatrix, translation, rotation);
+	Matrix_MtxFTranslateRotateZYX(Matrix_Current(), translation, rotation);
 }
 
-void Matrix_RotateAToB(Vec3f* a, Vec3f* b, u8 mode) {
+void Matrix_MtxFRotateAToB(MtxF* cmf, Vec3f* a, Vec3f* b, u8 mode) {
 	MtxF mtx;
 	Vec3f v;
 	f32 frac;
@@ -849,11 +899,10 @@ void Matrix_RotateAToB(Vec3f* a, Vec3f* b, u8 mode) {
 		// The vectors are parallel and opposite. The transformation does not work for
 		// this case, but simply inverting scale is sufficient in this situation.
 		f32 d = Vec3f_DistXYZ(aN, bN);
+		f32 s = d > 1.0f ? 1.0f : -1.0f;
 		
-		if (d > 1.0f)
-			Matrix_Scale(1.0f, 1.0f, 1.0f, mode);
-		else
-			Matrix_Scale(-1.0f, -1.0f, -1.0f, mode);
+		mtx = gMtxFClear;
+		mtx.xx = mtx.yy = mtx.zz = s;
 	} else {
 		frac = 1.0f / (1.0f + c);
 		v = Vec3f_Cross(aN, bN);
@@ -875,10 +924,16 @@ void Matrix_RotateAToB(Vec3f* a, Vec3f* b, u8 mode) {
 		mtx.wy = 0.0f;
 		mtx.wz = 0.0f;
 		mtx.ww = 1.0f;
-		
-		// apply to stack
-		Matrix_Mult(&mtx, mode);
 	}
+	
+	if (mode == MTXMODE_APPLY)
+		Matrix_MtxFMtxFMult(cmf, &mtx, cmf);
+	else
+		Matrix_MtxFCopy(cmf, &mtx);
+}
+
+void Matrix_RotateAToB(Vec3f* a, Vec3f* b, u8 mode) {
+	Matrix_MtxFRotateAToB(Matrix_Current(), a, b, mode);
 }
 
 void Matrix_MultVec4f_Ext(Vec4f* src, Vec4f* dest, MtxF* mtx) {
@@ -892,7 +947,7 @@ void Matrix_MtxFToYXZRotS(Vec3s* rotDest, s32 flag) {
 	f32 temp;
 	f32 temp2;
 	f32 temp3;
-	MtxF* mf = gCurrentMatrix;
+	MtxF* mf = Matrix_Current();
 	
 	temp = mf->xz;
 	temp *= temp;
@@ -1,17 +1,61 @@
 #include <ext_undo.h>
+#include <ext_zip.h>
+
+#define UNDO_GAP     16        // Equal bytes that still get folded into a run
+#define UNDO_DEFLATE 4096      // Smallest delta worth deflating
+#define UNDO_SLAB    (1 << 16) // Pool slab size
+#define UNDO_CLASS   9         // Pool size classes, 16 << n bytes
+
+/**
+ * Every registered region keeps one shadow copy of its bytes as of the
+ * last finished step. Steps only store the XOR of what changed against
+ * it, so applying one in either direction flips exactly those bytes.
+ */
+typedef struct UndoRegion {
+	struct UndoRegion* next;
+	void*  origin;
+	size_t size;
+	u8*    shadow;
+	UndoEvent* pending;
+	u32    refs;
+} UndoRegion;
 
 typedef struct {
-	UndoEvent** nodes;
+	UndoEvent** nodes; // Ring, oldest at head
+	UndoEvent** redo;
 	int max;
+	int head;
 	int num;
+	int numRedo;
+	
+	UndoRegion* region;
+	size_t budget;
+	size_t used;
+	bool   deflate;
+	f64    mergeTime;
+	Memfile delta;
+	
+	struct {
+		void** slab;
+		u8*    pos;
+		u8*    end;
+		void*  free[UNDO_CLASS];
+	} pool;
 } Undo;
 
+/**
+ * Delta layout: runs of
+ *   u32 skip from the end of the previous run, u32 len, len XOR bytes
+ * rawSize is set when data is deflated.
+ */
 typedef struct UndoEvent {
 	struct UndoEvent* next;
-	void*  origin;
+	UndoRegion* region;
 	u8*    data;
 	size_t size;
+	size_t rawSize;
 	int*   response;
+	f64    time;
 } UndoEvent;
 
 static Undo __instance__;
@@ -19,70 +63,587 @@ static Undo* this = &__instance__;
 
 void Undo_Init(u32 max) {
 	this->nodes = new(UndoEvent*[max]);
+	this->redo = new(UndoEvent*[max]);
 	this->max = max;
+	this->mergeTime = 0.5;
+	this->delta = Memfile_New();
+}
+
+// A budget of 0 keeps max steps regardless of their size
+void Undo_SetBudget(size_t bytes, bool deflate) {
+	this->budget = bytes;
+	this->deflate = deflate;
+}
+
+/**
+ * Steps started within sec of the previous one that touch a region it is
+ * still editing are merged into it, 0 keeps every step.
+ */
+void Undo_SetMergeTime(f64 sec) {
+	this->mergeTime = sec;
+}
+
+/*============================================================================*/
+
+static int Undo_Class(size_t size) {
+	int c = 0;
+	
+	while ((16ul << c) < size)
+		c++;
+	
+	return c;
+}
+
+// Small blocks come from per class free lists carved out of shared slabs
+static void* Undo_Alloc(size_t size) {
+	int c = Undo_Class(size);
+	void* p;
+	
+	if (c >= UNDO_CLASS)
+		return malloc(size);
+	
+	if ((p = this->pool.free[c])) {
+		this->pool.free[c] = *(void**)p;
+		
+		return p;
+	}
+	
+	if (!this->pool.pos || this->pool.pos + (16 << c) > this->pool.end) {
+		void** slab = malloc(UNDO_SLAB);
+		
+		osAssert(slab);
+		*slab = this->pool.slab;
+		this->pool.slab = slab;
+		this->pool.pos = (u8*)slab + 16;
+		this->pool.end = (u8*)slab + UNDO_SLAB;
+	}
+	
+	p = this->pool.pos;
+	this->pool.pos += 16 << c;
+	
+	return p;
+}
+
+static void Undo_Release(void* p, size_t size) {
+	int c = Undo_Class(size);
+	
+	if (!p)
+		return;
+	
+	if (c >= UNDO_CLASS) {
+		free(p);
+		
+		return;
+	}
+	
+	*(void**)p = this->pool.free[c];
+	this->pool.free[c] = p;
+}
+
+static UndoEvent* Undo_NewEvent() {
+	UndoEvent* event = Undo_Alloc(sizeof(UndoEvent));
+	
+	*event = (UndoEvent) { .time = sys_ftime() };
+	
+	return event;
 }
 
 static void Undo_FreeEvent(UndoEvent* event) {
-	if (event->next) Undo_FreeEvent(event->next);
-	delete(event->data, event);
+	while (event) {
+		UndoEvent* next = event->next;
+		UndoRegion* region = event->region;
+		
+		if (region) {
+			if (region->pending == event)
+				region->pending = NULL;
+			
+			if (--region->refs == 0) {
+				Node_Remove(this->region, region);
+				delete(region->shadow, region);
+			}
+		}
+		
+		this->used -= event->size;
+		Undo_Release(event->data, event->size);
+		Undo_Release(event, sizeof(UndoEvent));
+		event = next;
+	}
+}
+
+static UndoEvent** Undo_At(int i) {
+	return &this->nodes[(this->head + i) % this->max];
 }
 
+static void Undo_DropOldest() {
+	Undo_FreeEvent(*Undo_At(0));
+	this->head = (this->head + 1) % this->max;
+	this->num--;
+}
+
+/*============================================================================*/
+
+static void Undo_Emit(Memfile* out, u32 skip, const u8* a, const u8* b, u32 len) {
+	u32 head[2] = { skip, len };
+	u8* x;
+	
+	Memfile_Write(out, head, sizeof(head));
+	if (out->size + len >= out->memSize)
+		Memfile_Realloc(out, (out->size + len) * 2);
+	x = out->cast.u8 + out->seekPoint;
+	
+	for (u32 i = 0; i < len; i++)
+		x[i] = a[i] ^ b[i];
+	
+	out->seekPoint += len;
+	out->size += len;
+}
+
+/**
+ * Turns the edits done since the region was registered into a delta and
+ * brings the shadow up to date.
+ */
+static void Undo_Take(UndoEvent* event) {
+	UndoRegion* region = event->region;
+	const u8* cur = region->origin;
+	u8* shadow = region->shadow;
+	Memfile* out = &this->delta;
+	Memfile comp = Memfile_New();
+	size_t last = 0;
+	size_t i = 0;
+	
+	region->pending = NULL;
+	Memfile_Null(out);
+	
+	while (i < region->size) {
+		size_t start, end, eq = 0;
+		
+		while (i + 8 <= region->size && !memcmp(shadow + i, cur + i, 8))
+			i += 8;
+		while (i < region->size && shadow[i] == cur[i])
+			i++;
+		if (i == region->size)
+			break;
+		
+		for (start = i; i < region->size && eq < UNDO_GAP; i++)
+			eq = shadow[i] == cur[i] ? eq + 1 : 0;
+		end = i - eq;
+		
+		Undo_Emit(out, start - last, shadow + start, cur + start, end - start);
+		memcpy(shadow + start, cur + start, end - start);
+		last = end;
+	}
+	
+	if (this->deflate && out->size >= UNDO_DEFLATE)
+		if (!Memfile_Compress(&comp, out, 1, 0) && comp.size < out->size / 4 * 3) {
+			event->rawSize = out->size;
+			out = &comp;
+		}
+	
+	if (out->size) {
+		event->data = Undo_Alloc(out->size);
+		event->size = out->size;
+		memcpy(event->data, out->data, out->size);
+		this->used += out->size;
+	}
+	
+	Memfile_Free(&comp);
+}
+
+/**
+ * XOR the delta into the shadow and copy the runs it touched out to the
+ * origin, so the restored bytes never depend on the live ones.
+ */
 static void Undo_Apply(UndoEvent* event) {
-	memcpy(event->origin, event->data, event->size);
+	for (; event; event = event->next) {
+		UndoRegion* region = event->region;
+		Memfile raw = Memfile_New();
+		const u8* p = event->data;
+		const u8* end = p + event->size;
+		u8* dst = region->origin;
+		u8* shadow = region->shadow;
+		
+		if (event->rawSize) {
+			Memfile comp = Memfile_New();
+			
+			comp.data = event->data;
+			comp.size = comp.memSize = event->size;
+			comp.param.external = true;
+			
+			osAssert(!Memfile_Decompress(&raw, &comp));
+			p = raw.data;
+			end = p + raw.size;
+		}
+		
+		while (p < end) {
+			u32 head[2];
+			
+			memcpy(head, p, sizeof(head));
+			p += sizeof(head);
+			dst += head[0];
+			shadow += head[0];
+			
+			for (u32 i = 0; i < head[1]; i++)
+				shadow[i] ^= p[i];
+			memcpy(dst, shadow, head[1]);
+			
+			p += head[1];
+			dst += head[1];
+			shadow += head[1];
+		}
+		
+		Memfile_Free(&raw);
+	}
+}
+
+static bool Undo_IsEmpty(UndoEvent* event) {
+	for (; event; event = event->next)
+		if (event->size)
+			return false;
 	
-	if (event->next)
-		Undo_Apply(event->next);
+	return true;
+}
+
+static void Undo_ClearRedo() {
+	while (this->numRedo)
+		Undo_FreeEvent(this->redo[--this->numRedo]);
+}
+
+// Takes every delta still open except those of keep
+static void Undo_TakePending(UndoEvent* keep) {
+	for (UndoRegion* r = this->region; r; r = r->next) {
+		UndoEvent* n = keep;
+		
+		if (!r->pending)
+			continue;
+		
+		while (n && n != r->pending)
+			n = n->next;
+		
+		if (!n)
+			Undo_Take(r->pending);
+	}
+}
+
+// Finishes the open step and evicts the oldest ones past the budget
+static void Undo_Commit() {
+	Undo_TakePending(NULL);
+	
+	while (this->num && Undo_IsEmpty(*Undo_At(this->num - 1)))
+		Undo_FreeEvent(*Undo_At(--this->num));
+	
+	while (this->budget && this->used > this->budget && this->num > 1)
+		Undo_DropOldest();
+}
+
+/*============================================================================*/
+
+bool Undo_Undo() {
+	UndoEvent* event;
+	
+	Undo_Commit();
+	if (!this->num)
+		return false;
+	
+	event = *Undo_At(--this->num);
+	
+	if (event->response)
+		*event->response = true;
+	Undo_Apply(event);
+	this->redo[this->numRedo++] = event;
+	
+	return true;
+}
+
+bool Undo_Redo() {
+	UndoEvent* event;
+	
+	Undo_Commit();
+	if (!this->numRedo)
+		return false;
+	
+	event = this->redo[--this->numRedo];
+	
+	if (event->response)
+		*event->response = true;
+	Undo_Apply(event);
+	*Undo_At(this->num++) = event;
+	
+	return true;
 }
 
 void Undo_Update(Input* input) {
-	bool undo = false;
+	if (!Input_GetKey(input, KEY_LEFT_CONTROL)->hold)
+		return;
 	
-	if (Input_GetKey(input, KEY_LEFT_CONTROL)->hold)
-		if (Input_GetKey(input, KEY_Z)->press)
-			undo = true;
+	if (Input_GetKey(input, KEY_Y)->press)
+		Undo_Redo();
 	
-	if (this->num && undo) {
-		UndoEvent* event = this->nodes[--this->num];
-		
-		if (event->response)
-			*event->response = true;
-		Undo_Apply(event);
-		Undo_FreeEvent(event);
-		this->nodes[this->num] = NULL;
+	else if (Input_GetKey(input, KEY_Z)->press) {
+		if (Input_GetKey(input, KEY_LEFT_SHIFT)->hold)
+			Undo_Redo();
+		else
+			Undo_Undo();
 	}
 }
 
 void Undo_Destroy() {
-	for (int i = 0; i < this->num; i++)
-		Undo_FreeEvent(this->nodes[i]);
+	Undo_ClearRedo();
+	while (this->num)
+		Undo_DropOldest();
 	
-	delete(this->nodes);
+	while (this->pool.slab) {
+		void** slab = this->pool.slab;
+		
+		this->pool.slab = *slab;
+		free(slab);
+	}
+	
+	Memfile_Free(&this->delta);
+	delete(this->nodes, this->redo);
+	*this = (Undo) {};
 }
 
+/**
+ * The step before the new one stays open so it can still be merged into,
+ * everything older is finished here.
+ */
 UndoEvent* Undo_New() {
-	UndoEvent* node = NULL;
+	UndoEvent* node = Undo_NewEvent();
+	UndoEvent* top = this->num ? *Undo_At(this->num - 1) : NULL;
+	int prev;
 	
-	if (this->num == this->max) {
-		Undo_FreeEvent(this->nodes[0]);
-		arrmove_l(this->nodes, 0, this->max);
-		this->nodes[this->num - 1] = node = new(UndoEvent);
-	} else {
-		this->nodes[this->num++] = node = new(UndoEvent);
+	// With merging off nothing can join top, so it is finished here too
+	Undo_TakePending(this->mergeTime > 0 ? top : NULL);
+	Undo_ClearRedo();
+	
+	// Never registered, or finished without changing anything
+	if (top && !top->region) {
+		Undo_FreeEvent(top);
+		top = NULL;
+		this->num--;
+	}
+	
+	prev = this->num - 1 - !!top;
+	if (prev >= 0 && Undo_IsEmpty(*Undo_At(prev))) {
+		Undo_FreeEvent(*Undo_At(prev));
+		if (top)
+			*Undo_At(prev) = top;
+		this->num--;
 	}
 	
+	while (this->budget && this->used > this->budget && this->num > 1)
+		Undo_DropOldest();
+	if (this->num == this->max)
+		Undo_DropOldest();
+	
+	*Undo_At(this->num++) = node;
+	
 	return node;
 }
 
+/**
+ * Moves the open previous step into the fresh event so that the caller's
+ * handle keeps working, then drops the previous slot.
+ */
+static void Undo_Merge(UndoEvent* event, UndoEvent* prev) {
+	int* response = event->response;
+	
+	*event = *prev;
+	event->time = sys_ftime();
+	if (response)
+		event->response = response;
+	
+	for (UndoEvent* n = event; n; n = n->next)
+		if (n->region->pending == (n == event ? prev : n))
+			n->region->pending = n;
+	
+	Undo_Release(prev, sizeof(UndoEvent));
+	*Undo_At(this->num - 2) = event;
+	this->num--;
+}
+
+static bool Undo_CanMerge(UndoEvent* event, UndoEvent* prev, UndoRegion* region) {
+	bool hit = false;
+	
+	if (this->mergeTime <= 0 || event->region || !prev)
+		return false;
+	if (event->time - prev->time > this->mergeTime)
+		return false;
+	
+	// Only while every part of prev is still open
+	for (UndoEvent* n = prev; n; n = n->next) {
+		if (n->region->pending != n)
+			return false;
+		if (n->region == region)
+			hit = true;
+	}
+	
+	return hit;
+}
+
+// Moves the first run of a delta by shift bytes, deflated ones stay raw
+static void Undo_Rebase(UndoEvent* event, size_t shift) {
+	u32 skip;
+	
+	if (!event->size)
+		return;
+	
+	if (event->rawSize) {
+		Memfile comp = Memfile_New();
+		Memfile raw = Memfile_New();
+		
+		comp.data = event->data;
+		comp.size = comp.memSize = event->size;
+		comp.param.external = true;
+		osAssert(!Memfile_Decompress(&raw, &comp));
+		
+		this->used += raw.size - event->size;
+		Undo_Release(event->data, event->size);
+		event->data = Undo_Alloc(raw.size);
+		event->size = raw.size;
+		event->rawSize = 0;
+		memcpy(event->data, raw.data, raw.size);
+		Memfile_Free(&raw);
+	}
+	
+	memcpy(&skip, event->data, sizeof(skip));
+	skip += shift;
+	memcpy(event->data, &skip, sizeof(skip));
+}
+
+static bool Undo_Overlaps(UndoRegion* region, u8* lo, u8* hi) {
+	u8* origin = region->origin;
+	
+	return origin < hi && origin + region->size > lo;
+}
+
+/**
+ * Folds every region overlapping [origin, origin + size) into one that
+ * covers all of them, the deltas of their steps are rebased onto it. One
+ * open delta of step stays open on the new region, the others are taken.
+ * Returns NULL if nothing overlaps.
+ */
+static UndoRegion* Undo_FindRegion(UndoEvent* step, void* origin, size_t size) {
+	u8* lo = origin;
+	u8* hi = lo + size;
+	UndoRegion* hit = NULL;
+	UndoRegion* region;
+	int num = 0;
+	bool grown;
+	
+	do {
+		grown = false;
+		
+		for (UndoRegion* r = this->region; r; r = r->next) {
+			if (!Undo_Overlaps(r, lo, hi))
+				continue;
+			
+			if ((u8*)r->origin < lo || (u8*)r->origin + r->size > hi) {
+				lo = Min(lo, (u8*)r->origin);
+				hi = Max(hi, (u8*)r->origin + r->size);
+				grown = true;
+			}
+		}
+	} while (grown);
+	
+	for (UndoRegion* r = this->region; r; r = r->next) {
+		if (Undo_Overlaps(r, lo, hi)) {
+			hit = r;
+			num++;
+		}
+	}
+	
+	if (num <= 1 && (!hit || (hit->origin == lo && hit->size == hi - lo)))
+		return hit;
+	
+	region = new(UndoRegion);
+	region->origin = lo;
+	region->size = hi - lo;
+	region->shadow = memdup(lo, hi - lo);
+	
+	for (UndoRegion* r = this->region, * next; r; r = next) {
+		size_t shift = (u8*)r->origin - lo;
+		
+		next = r->next;
+		if (!Undo_Overlaps(r, lo, hi))
+			continue;
+		
+		if (r->pending) {
+			UndoEvent* n = step;
+			
+			while (n && n != r->pending)
+				n = n->next;
+			
+			if (n && !region->pending)
+				region->pending = n;
+			else
+				Undo_Take(r->pending);
+		}
+		memcpy(region->shadow + shift, r->shadow, r->size);
+		
+		for (int i = 0; i < this->num + this->numRedo; i++) {
+			UndoEvent* n = i < this->num ? *Undo_At(i) : this->redo[i - this->num];
+			
+			for (; n; n = n->next) {
+				if (n->region != r)
+					continue;
+				
+				Undo_Rebase(n, shift);
+				n->region = region;
+			}
+		}
+		
+		region->refs += r->refs;
+		Node_Remove(this->region, r);
+		delete(r->shadow, r);
+	}
+	
+	Node_Add(this->region, region);
+	
+	return region;
+}
+
+/**
+ * Regions are tracked by origin and size. The first registration copies
+ * the region once, later ones only store what changed. Overlapping
+ * registrations share one region.
+ */
 void Undo_Register(UndoEvent* event, void* origin, size_t size) {
-	if (event->data) {
-		if (!event->next)
-			event->next = new(UndoEvent);
-		Undo_Register(event->next, origin, size);
+	UndoRegion* region = Undo_FindRegion(event, origin, size);
+	
+	if (!region) {
+		region = new(UndoRegion);
+		region->origin = origin;
+		region->size = size;
+		region->shadow = memdup(origin, size);
+		Node_Add(this->region, region);
 	} else {
-		event->origin = origin;
-		event->data = memdup(origin, size);
-		event->size = size;
+		UndoEvent* prev = this->num > 1 && *Undo_At(this->num - 1) == event ? *Undo_At(this->num - 2) : NULL;
+		
+		if (Undo_CanMerge(event, prev, region)) {
+			Undo_Merge(event, prev);
+			
+			return;
+		}
+		
+		for (UndoEvent* n = event; n; n = n->next)
+			if (n->region == region)
+				return;
+		
+		// Changes made outside of any step are folded into this step's delta
+		if (region->pending)
+			Undo_Take(region->pending);
+	}
+	
+	if (event->region) {
+		while (event->next)
+			event = event->next;
+		event = event->next = Undo_NewEvent();
 	}
+	
+	event->region = region;
+	region->pending = event;
+	region->refs++;
 }
 
 void Undo_Response(UndoEvent* event, int* dst) {
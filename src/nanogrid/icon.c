@@ -1,6 +1,7 @@
 #include <nano_grid.h>
 #include <ext_interface.h>
 #include <nanovg/src/nanovg.h>
+#include <ext_texel.h>
 
 #define GET_LITVAL(val) \
 		((val) - 'a')
@@ -19,68 +20,259 @@ static const int sIconIdTbl[MAX_X * MAX_Y] = {
 	#define DEFINE_ICON(icon, bank, val, set) [ICON_INDEX(bank, val)] = icon,
 #include "tbl_icon.h"
 };
-static u8* sIconData[ICON_MAX];
+static int sIconEntry[ICON_MAX];
+static int sIconPage[8];
+static Atlas sIconAtlas;
 
-static void Icon_Init() {
-	extern DataFile gBlenderIcons;
+#define ICON_CACHE_MAGIC   0x4E434349 // ICCN
+#define ICON_CACHE_VERSION 1
+
+/**
+ * Cache layout:
+ *   IconCacheHead, s32 sIconEntry[ICON_MAX], AtlasEntry[numEntry],
+ *   numPage RGBA pages of w * h
+ */
+typedef struct {
+	u32 magic;
+	u32 version;
+	u64 key;
+	f32 pixelScale;
+	f32 iconSize;
+	u32 numIcon;
+	u32 numEntry;
+	u32 numPage;
+	u32 w, h;
+	u32 pad; // Keeps the struct free of implicit padding for memcmp
+} IconCacheHead;
+
+static const char* Icon_CacheFile() {
+	return x_fmt("%sicons.cache", sys_appdata());
+}
+
+// FNV-1a over words, cheap enough to run on every launch
+static u64 Icon_Key(const u8* data, size_t size) {
+	u64 key = 0xCBF29CE484222325ull ^ size;
+	size_t i = 0;
+	
+	for (; i + 8 <= size; i += 8) {
+		u64 w;
+		
+		memcpy(&w, data + i, 8);
+		key = (key ^ w) * 0x100000001B3ull;
+	}
+	for (; i < size; i++)
+		key = (key ^ data[i]) * 0x100000001B3ull;
+	
+	return key;
+}
+
+static bool Icon_LoadCache(IconCacheHead* want) {
+	FILE* f = fopen(Icon_CacheFile(), "rb");
+	IconCacheHead head;
+	bool ok = false;
+	
+	if (!f)
+		return false;
+	
+	if (fread(&head, sizeof(head), 1, f) != 1)
+		goto close;
 	
+	want->numEntry = head.numEntry;
+	want->numPage = head.numPage;
+	if (memcmp(&head, want, sizeof(head)) || head.numPage > ArrCount(sIconPage))
+		goto close;
+	
+	if (fread(sIconEntry, sizeof(sIconEntry), 1, f) != 1)
+		goto close;
+	
+	// An entry outside the atlas would leave Icon_Paint without a rect
+	for (int i = 0; i < ICON_MAX; i++)
+		if (sIconEntry[i] < 0 || sIconEntry[i] >= (int)head.numEntry)
+			goto close;
+	
+	Atlas_Init(&sIconAtlas, head.w, head.h, 1, true);
+	sIconAtlas.page = new(AtlasPage[head.numPage]);
+	
+	for (u32 i = 0; i < head.numEntry; i++) {
+		AtlasEntry e;
+		
+		if (fread(&e, sizeof(e), 1, f) != 1 || e.page < 0 || e.page >= (int)head.numPage)
+			goto fail;
+		if (e.rect.x < 0 || e.rect.y < 0 || e.rect.w <= 0 || e.rect.h <= 0)
+			goto fail;
+		if (e.rect.x + e.rect.w > (int)head.w || e.rect.y + e.rect.h > (int)head.h)
+			goto fail;
+		Arli_Add(&sIconAtlas.entry, &e);
+	}
+	
+	// Pages are read straight into their images, the skyline is not kept
+	for (u32 i = 0; i < head.numPage; i++) {
+		Image* img = &sIconAtlas.page[i].img;
+		
+		*img = Image_New();
+		img->x = head.w;
+		img->y = head.h;
+		img->channels = 4;
+		img->memSize = img->size = head.w * head.h * 4;
+		img->data = malloc(img->size);
+		sIconAtlas.numPage++;
+		
+		if (fread(img->data, img->size, 1, f) != 1)
+			goto fail;
+	}
+	
+	ok = true;
+	goto close;
+	
+	fail:
+	Atlas_Free(&sIconAtlas);
+	close:
+	fclose(f);
+	
+	return ok;
+}
+
+static void Icon_SaveCache(IconCacheHead* head) {
+	const char* file = Icon_CacheFile();
+	const char* tmp = x_fmt("%s.tmp", file);
+	FILE* f = fopen(tmp, "wb");
+	bool ok;
+	
+	if (!f)
+		return;
+	
+	head->numEntry = sIconAtlas.entry.num;
+	head->numPage = sIconAtlas.numPage;
+	
+	ok = fwrite(head, sizeof(*head), 1, f) == 1;
+	ok = ok && fwrite(sIconEntry, sizeof(sIconEntry), 1, f) == 1;
+	for (int i = 0; ok && i < sIconAtlas.entry.num; i++)
+		ok = fwrite(Atlas_Get(&sIconAtlas, i), sizeof(AtlasEntry), 1, f) == 1;
+	for (int i = 0; ok && i < sIconAtlas.numPage; i++)
+		ok = fwrite(sIconAtlas.page[i].img.data, sIconAtlas.page[i].img.size, 1, f) == 1;
+	
+	// Written aside and moved in place so a reader never sees half a file
+	if (fclose(f) || !ok || sys_mv(tmp, file))
+		sys_rm(tmp);
+}
+
+/**
+ * The used icons are rasterized in one pass over their bounding box of
+ * the sheet instead of one pass over every shape per icon.
+ */
+static void Icon_Rasterize(f32 size) {
+	extern DataFile gBlenderIcons;
 	Svg* vgicon = Svg_New(gBlenderIcons.data, gBlenderIcons.size);
-	f32 scale = SPLIT_ICON / 16.0;
-	
-	for (int y = 0; y < MAX_Y; y++) {
-		for (int x = 0; x < MAX_X; x++) {
-			int id = x + MAX_X * y;
-			
-			if (sIconIdTbl[id] == ICON_NONE)
-				continue;
-			
-			Rect* rect = new(Rect);
-			*rect = Rect_New(
-				5 + (16 + 5) * x,
-				10 + (16 + 5) * y,
-				16, id);
-			
-			nested(int, process, (Rect * r)) {
-				int id = sIconIdTbl[r->h];
-				
-				r->h = r->w;
-				sIconData[id] = Svg_Rasterize(vgicon, scale, r);
-				delete(r);
-				
-				return 0;
-			};
-			
-			Parallel_Add((void*)process, rect);
-		}
+	f32 scale = size / 16.0;
+	int isize = size;
+	Rect bound = { INT32_MAX, INT32_MAX, 0, 0 };
+	u8* sheet;
+	u8* icon;
+	
+	for (int id = 0; id < MAX_X * MAX_Y; id++) {
+		int x = id % MAX_X;
+		int y = id / MAX_X;
+		
+		if (sIconIdTbl[id] == ICON_NONE)
+			continue;
+		
+		bound.x = Min(bound.x, 5 + (16 + 5) * x);
+		bound.y = Min(bound.y, 10 + (16 + 5) * y);
+		bound.w = Max(bound.w, 5 + (16 + 5) * x + 16);
+		bound.h = Max(bound.h, 10 + (16 + 5) * y + 16);
 	}
 	
-	Parallel_Exec(sys_getcorenum() * 1.5);
+	bound.w -= bound.x;
+	bound.h -= bound.y;
+	
+	// Margin for rounding the scaled origin of each icon down
+	bound.w += 2;
+	bound.h += 2;
 	
+	sheet = Svg_Rasterize(vgicon, scale, &bound);
 	Svg_Delete(vgicon);
+	icon = new(u8[isize * isize * 4]);
+	
+	Atlas_Init(&sIconAtlas, 1024, 1024, 1, true);
+	for (int id = 0; id < MAX_X * MAX_Y; id++) {
+		int x = (int)((5 + (16 + 5) * (id % MAX_X)) * scale) - bound.x;
+		int y = (int)((10 + (16 + 5) * (id / MAX_X)) * scale) - bound.y;
+		
+		if (sIconIdTbl[id] == ICON_NONE)
+			continue;
+		
+		for (int j = 0; j < isize; j++)
+			memcpy(&icon[j * isize * 4], &sheet[((y + j) * bound.w + x) * 4], isize * 4);
+		
+		sIconEntry[sIconIdTbl[id]] = Atlas_AddRaw(&sIconAtlas, icon, isize, isize);
+	}
+	
+	delete(sheet, icon);
 }
 
+static void Icon_Init() {
+	extern DataFile gBlenderIcons;
+	IconCacheHead head = {
+		.magic      = ICON_CACHE_MAGIC,
+		.version    = ICON_CACHE_VERSION,
+		.key        = Icon_Key(gBlenderIcons.data, gBlenderIcons.size),
+		.pixelScale = gPixelScale,
+		.iconSize   = SPLIT_ICON,
+		.numIcon    = ICON_MAX,
+		.w          = 1024,
+		.h          = 1024,
+	};
+	
+	if (Icon_LoadCache(&head))
+		return;
+	
+	memset(sIconEntry, 0, sizeof(sIconEntry));
+	Icon_Rasterize(head.iconSize);
+	osAssert(sIconAtlas.numPage <= ArrCount(sIconPage));
+	Icon_SaveCache(&head);
+}
+
+// Runs once the first NanoVG context exists, gPixelScale is known by then
 static void Icon_NanoInit(void* vg) {
-	for (int y = 0; y < MAX_Y; y++) {
-		for (int x = 0; x < MAX_X; x++) {
-			int id = sIconIdTbl[x + MAX_X * y];
-			
-			if (id == ICON_NONE)
-				continue;
-			
-			int imgid = nvgCreateImageRGBA(vg, SPLIT_ICON, SPLIT_ICON, 0, sIconData[id]);
-			osLog("%d -> %d", id, imgid);
-			osAssert(id == imgid);
-		}
+	if (!sIconAtlas.numPage)
+		Icon_Init();
+	
+	for (int i = 0; i < sIconAtlas.numPage; i++) {
+		Image* img = &sIconAtlas.page[i].img;
+		int imgid = nvgCreateImageRGBA(vg, img->x, img->y, 0, img->data);
+		
+		// Every context creates the pages first, so the ids match
+		osLog("icon page %d -> %d", i, imgid);
+		osAssert(!sIconPage[i] || sIconPage[i] == imgid);
+		sIconPage[i] = imgid;
 	}
 }
 
 static void Icon_Dest() {
-	for (int i = 0; i < ArrCount(sIconData); i++)
-		delete(sIconData[i]);
+	Atlas_Free(&sIconAtlas);
+}
+
+/**
+ * Pattern that maps the atlas entry of icon onto r, all icons share the
+ * atlas pages so drawing them does not switch textures.
+ */
+NVGpaint Icon_Paint(void* vg, Rect r, int icon) {
+	AtlasEntry* e = Atlas_Get(&sIconAtlas, sIconEntry[icon]);
+	f32 s;
+	
+	// Not in the atlas, draws nothing
+	if (!e)
+		return (NVGpaint) {};
+	
+	s = (f32)r.w / e->rect.w;
+	
+	return nvgImagePattern(vg,
+			r.x - e->rect.x * s, r.y - e->rect.y * s,
+			sIconAtlas.w * s, sIconAtlas.h * s,
+			0, sIconPage[e->page], 1.0f);
 }
 
 onlaunch_func_t Icon_Construct() {
-	gUiInitFunc = Icon_Init;
 	gUiNanoFunc = Icon_NanoInit;
 	gUiDestFunc = Icon_Dest;
 }
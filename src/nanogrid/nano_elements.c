@@ -20,8 +20,6 @@ typedef void (*ElementFunc)(struct ElementQueCall*);
 static void Textbox_Set(ElTextbox*, Split*);
 
 typedef struct ElementQueCall {
-	struct ElementQueCall* next;
-	
 	void*       arg;
 	Split*      split;
 	ElementFunc func;
@@ -60,10 +58,26 @@ typedef struct BoxContext {
 	int    index;
 } BoxContext;
 
+/**
+ * Bump allocator for elements that only live for one frame. Whatever did
+ * not fit is spilled to the heap and the block grows to cover it on the
+ * next reset, so a steady UI stops allocating after a few frames.
+ */
+typedef struct {
+	u8*    data;
+	size_t size;
+	size_t used;
+	size_t peak;
+	void*  spill;
+} ElArena;
+
 typedef struct {
 	NanoGrid*       nano;
 	Split*          split;
-	ElementQueCall* head;
+	ElementQueCall* queue;
+	int             numQueue;
+	int             maxQueue;
+	ElArena         arena;
 	char         textStoreBuf[TEXTBOX_BUFFER_SIZE];
 	ElTextbox*   textbox;
 	BoxContext   boxCtx;
@@ -99,6 +113,19 @@ void* ElementState_New(void) {
 	return elemState;
 }
 
+void ElementState_Free(void* elemState) {
+	ElementState* this = elemState;
+	
+	while (this->arena.spill) {
+		void** spill = this->arena.spill;
+		
+		this->arena.spill = *spill;
+		free(spill);
+	}
+	
+	delete(this->arena.data, this->queue, this);
+}
+
 void ElementState_Set(void* elemState) {
 	sElemState = elemState;
 }
@@ -501,7 +528,7 @@ void Gfx_Icon(void* vg, Rect r, NVGcolor col, int icon) {
 	r = Rect_Scale(r, 0, scale / 2);
 	r.w = SPLIT_ICON;
 	
-	NVGpaint paint = nvgImagePattern(vg, UnfoldRect(r), 0, icon, 1.0f);
+	NVGpaint paint = Icon_Paint(vg, r, icon);
 	
 	paint.innerColor = col;
 	paint.outerColor = col;
@@ -520,23 +547,73 @@ void Gfx_TextShadow(void* vg) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
-static ElementQueCall* Element_QueueElement(NanoGrid* nano, Split* split, ElementFunc func, void* arg, const char* elemFunc) {
+static void* ElArena_Alloc(ElArena* this, size_t size) {
+	void** spill;
+	void* p;
+	
+	size = (size + 15) & ~15;
+	this->peak += size;
+	
+	if (this->used + size <= this->size) {
+		p = this->data + this->used;
+		this->used += size;
+		
+		return memset(p, 0, size);
+	}
+	
+	spill = calloc(16 + size);
+	*spill = this->spill;
+	this->spill = spill;
+	
+	return (u8*)spill + 16;
+}
+
+static void ElArena_Reset(ElArena* this) {
+	while (this->spill) {
+		void** spill = this->spill;
+		
+		this->spill = *spill;
+		free(spill);
+	}
+	
+	if (this->peak > this->size) {
+		this->size = this->peak + this->peak / 2;
+		free(this->data);
+		this->data = malloc(this->size);
+	}
+	
+	this->used = this->peak = 0;
+}
+
+#define Element_Temp(type) ElArena_Alloc(&sElemState->arena, sizeof(type))
+
+// The returned call is only valid until the next one is queued
+static ElementQueCall* Element_QueueCall(NanoGrid* nano, Split* split, ElementFunc func, void* arg, const char* elemFunc) {
 	ElementQueCall* node;
 	
-	node = new(ElementQueCall);
-	Node_Add(sElemState->head, node);
-	node->nano = nano;
-	node->split = split;
-	node->func = func;
-	node->arg = arg;
-	node->update = true;
+	if (sElemState->numQueue == sElemState->maxQueue) {
+		sElemState->maxQueue = Max(64, sElemState->maxQueue * 2);
+		sElemState->queue = realloc(sElemState->queue, sizeof(ElementQueCall) * sElemState->maxQueue);
+	}
+	
+	node = &sElemState->queue[sElemState->numQueue++];
+	*node = (ElementQueCall) {
+		.nano     = nano,
+		.split    = split,
+		.func     = func,
+		.arg      = arg,
+		.elemFunc = elemFunc,
+		.update   = true,
+	};
 	
+	return node;
+}
+
+static ElementQueCall* Element_QueueElement(NanoGrid* nano, Split* split, ElementFunc func, void* arg, const char* elemFunc) {
 	if (sElemState->forceDisable)
 		((Element*)arg)->disableTemp = true;
 	
-	node->elemFunc = elemFunc;
-	
-	return node;
+	return Element_QueueCall(nano, split, func, arg, elemFunc);
 }
 
 static s32 Element_PressCondition(NanoGrid* nano, Split* split, Element* this) {
@@ -1211,11 +1288,10 @@ static void Element_TextDraw(ElementQueCall* call) {
 }
 
 ElText* Element_Text(const char* txt) {
-	ElText* this = new(ElText);
+	ElText* this = Element_Temp(ElText);
 	
 	osAssert(NANO && SPLIT);
 	this->element.name = txt;
-	this->element.doFree = true;
 	
 	ELEMENT_QUEUE(Element_TextDraw);
 	
@@ -1245,9 +1321,15 @@ static void Element_CheckboxDraw(ElementQueCall* call) {
 	
 	r.w = r.h;
 	
-	if (this->element.toggle)
+	if (this->element.toggle) {
+		u32 anim = gAnimTick;
+		
 		Math_DelSmoothStepToF(&this->lerp, 0.8f - sElemState->breath * 0.08, 0.178f, 0.1f, 0.0f);
-	else
+		
+		// Breathing alone should not keep the window from idling
+		if (fabsf(this->lerp - 0.8f) <= 0.1f)
+			gAnimTick = anim;
+	} else
 		Math_DelSmoothStepToF(&this->lerp, 0.0f, 0.268f, 0.1f, 0.0f);
 	
 	Gfx_DrawRounderOutline(vg, r, this->element.light);
@@ -2125,7 +2207,7 @@ void Element_Separator(bool drawLine) {
 	osAssert(NANO && SPLIT);
 	
 	if (drawLine) {
-		this = new(Element);
+		this = Element_Temp(Element);
 		
 		sElemState->rowY += SPLIT_ELEM_X_PADDING;
 		
@@ -2133,7 +2215,6 @@ void Element_Separator(bool drawLine) {
 		this->rect.w = SPLIT->rect.w - SPLIT_ELEM_X_PADDING * 4 - sElemState->shiftX;
 		this->rect.y = sElemState->rowY - SPLIT_ELEM_X_PADDING * 0.5;
 		this->rect.h = 1;
-		this->doFree = true;
 		
 		sElemState->rowY += SPLIT_ELEM_X_PADDING;
 		
@@ -2193,7 +2274,7 @@ static void Element_BoxDraw(ElementQueCall* call) {
 static ElBox* BoxPush() {
 	BoxContext* ctx = &sElemState->boxCtx;
 	
-	return ctx->list[ctx->index++] = new(ElBox);
+	return ctx->list[ctx->index++] = Element_Temp(ElBox);
 }
 
 static ElBox* BoxPop() {
@@ -2219,7 +2300,6 @@ int Element_Box(BoxState state, ...) {
 		
 		this->element.type = ELEM_TYPE_BOX;
 		this->element.instantColor = true;
-		this->element.doFree = true;
 		this->rowY = sElemState->rowY;
 		this->panel = panel;
 		
@@ -2396,13 +2476,7 @@ static void Element_DisplayName(Element* this) {
 	
 	this->dispText = true;
 	
-	node = calloc(sizeof(ElementQueCall));
-	Node_Add(sElemState->head, node);
-	node->nano = NANO;
-	node->split = SPLIT;
-	node->func = Element_TextDraw;
-	node->arg = this;
-	node->elemFunc = "Element_DisplayName";
+	node = Element_QueueCall(NANO, SPLIT, Element_TextDraw, this, "Element_DisplayName");
 	node->update = false;
 }
 
@@ -2616,52 +2690,47 @@ static void Element_DrawInstance(ElementQueCall* elem, Element* this) {
 }
 
 void Element_Draw(NanoGrid* nano, Split* split, bool header) {
-	ElementQueCall* elem = sElemState->head;
-	
-	while (elem) {
-		ElementQueCall* next = elem->next;
-		Element* this = elem->arg;
+	for (int i = 0; i < sElemState->numQueue; i++) {
+		ElementQueCall elem = sElemState->queue[i];
+		Element* this = elem.arg;
 		
-		if (elem->split == nano->killSplit) {
-			elem = next;
+		if (elem.split == nano->killSplit)
 			continue;
-		}
 		
-		if (this && this->header == header && elem->split == split) {
-			osLog("ElemDraw%s: " PRNT_PRPL "%sDraw", header ? "Header" : "Split", elem->elemFunc);
+		if (this && this->header == header && elem.split == split) {
+			osLog("ElemDraw%s: " PRNT_PRPL "%sDraw", header ? "Header" : "Split", elem.elemFunc);
+			
+			// Drawn calls stay in the queue until the flush with no arg
+			sElemState->queue[i].arg = NULL;
 			
 			osLog("Update Element");
-			if (elem->update)
-				Element_UpdateElement(elem);
+			if (elem.update)
+				Element_UpdateElement(&elem);
 			
 			osLog("Draw Instance");
-			if (split->dummy || header || !Element_DisableDraw(elem->arg, elem->split))
-				Element_DrawInstance(elem, this);
+			if (split->dummy || header || !Element_DisableDraw(elem.arg, elem.split))
+				Element_DrawInstance(&elem, this);
 			
 			osLog("Free");
 			if (this->doFree)
-				delete(elem->arg);
-			
-			osLog("Kill Node");
-			Node_Kill(sElemState->head, elem);
+				delete(elem.arg);
 		}
-		
-		elem = next;
 	}
 	
 	osLog("ElemDraw%s: Done", header ? "Header" : "Split");
 }
 
 void Element_Flush(NanoGrid* nano) {
-	while (sElemState->head) {
-		Element* this = sElemState->head->arg;
+	for (int i = 0; i < sElemState->numQueue; i++) {
+		ElementQueCall* elem = &sElemState->queue[i];
+		Element* this = elem->arg;
 		
-		if (sElemState->head->split != nano->killSplit)
+		if (this && elem->split != nano->killSplit)
 			if (this->doFree) delete(this);
-		
-		Node_Kill(sElemState->head, sElemState->head);
 	}
 	
+	sElemState->numQueue = 0;
+	ElArena_Reset(&sElemState->arena);
 	nano->killSplit = NULL;
 }
 
@@ -2769,6 +2838,9 @@ void osMsg_Draw(NanoGrid* nano) {
 	if (msg >= end)
 		return;
 	
+	// The fade runs off a timer, keep frames coming until it is done
+	gAnimTick++;
+	
 	Rect r = {
 		SPLIT_ELEM_X_PADDING,
 		nano->wdim->y - (SPLIT_ELEM_X_PADDING + SPLIT_BAR_HEIGHT * 2),
@@ -2886,4 +2958,8 @@ void osMsg(int icon, const char* fmt, ...) {
 	
 	msg->timer = TimerSet(0);
 	msg->icon = icon;
+	
+	// Only the thread owning the context can look the window up
+	if (GET_GLFWWINDOW())
+		Window_RequestRedraw(GET_WINDOW());
 }
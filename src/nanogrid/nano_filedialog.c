@@ -1,5 +1,23 @@
 #include <nano_grid.h>
 #include <ext_interface.h>
+#include <dirent.h>
+
+#define DIR_SCAN_BATCH 256
+#define DIR_CACHE_NUM  8
+
+// Shared by the dialog and the worker, the last one to let go frees it
+struct DirScan {
+	thread_t thd;
+	mutex_t  mutex;
+	vbool    cancel;
+	vbool    done;
+	int      refs;
+	time_t   mtime;
+	char     path[PATH_BUFFER_SIZE];
+	List*    filter;  // Copy, the dialog may be gone before the worker is
+	List     files;   // Batch handed over by the worker, guarded by mutex
+	List     folders;
+};
 
 struct FileDialog {
 	NanoGrid nano;
@@ -51,8 +69,23 @@ struct FileDialog {
 	List      files;
 	List      folders;
 	ScrollBar scroll;
+	
+	struct DirScan* scan;
 };
 
+typedef struct {
+	char*  path;
+	char*  filter;
+	time_t mtime;
+	List   files;
+	List   folders;
+} DirCache;
+
+static DirCache sDirCache[DIR_CACHE_NUM];
+static int sDirCacheNext;
+
+static void SetCullFlag(FileDialog* this, const char* filter);
+
 typedef struct {
 	List* filter;
 	enum FileDialogAction action;
@@ -214,6 +247,306 @@ static const char* Travel(FileDialog* this, const char* path) {
 	return NULL;
 }
 
+static void CullItems(FileDialog* this) {
+	delete(this->searchFilterFlagList);
+	this->searchFilterFlagList = new(s8[this->files.num + this->folders.num + 1]);
+	SetCullFlag(this, this->search.search.txt);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static bool DirScan_IsFolder(struct DirScan* scan, const struct dirent* entry) {
+	char path[PATH_BUFFER_SIZE];
+	
+#ifdef _DIRENT_HAVE_D_TYPE
+	if (entry->d_type == DT_DIR)
+		return true;
+	if (entry->d_type == DT_REG)
+		return false;
+#endif
+	
+	snprintf(path, PATH_BUFFER_SIZE, "%s%s", scan->path, entry->d_name);
+	
+	return sys_isdir(path);
+}
+
+// Entries are joined onto the path as is, so it always ends in a slash
+static void DirScan_Path(char* dst, const char* path) {
+	strncpy(dst, path, PATH_BUFFER_SIZE - 2);
+	dst[PATH_BUFFER_SIZE - 2] = '\0';
+	if (!strend(dst, "/")) strcat(dst, "/");
+}
+
+static bool DirScan_Match(struct DirScan* scan, const char* name) {
+	if (!scan->filter)
+		return true;
+	
+	forlist(item, *scan->filter)
+		if (strend(name, item))
+			return true;
+	
+	return false;
+}
+
+// Appends the items of src to dst without copying the strings
+static void DirScan_Move(List* dst, List* src) {
+	if (!src->num)
+		return;
+	
+	dst->item = realloc(dst->item, sizeof(char*[dst->num + src->num]));
+	memcpy(dst->item + dst->num, src->item, sizeof(char*[src->num]));
+	dst->num += src->num;
+	dst->p.alnum = 0;
+	
+	delete(src->item);
+	src->num = 0;
+	src->p.alnum = 0;
+}
+
+/**
+ * Reads the directory once, classifying entries by d_type where the
+ * platform provides it, and hands them over in batches.
+ */
+static void DirScan_Release(struct DirScan* scan) {
+	int refs;
+	
+	mutex_scope(scan->mutex, {
+		refs = --scan->refs;
+	});
+	
+	if (refs)
+		return;
+	
+	if (scan->filter) {
+		List_Free(scan->filter);
+		delete(scan->filter);
+	}
+	
+	List_Free(&scan->files);
+	List_Free(&scan->folders);
+	mutex_dest(&scan->mutex);
+	delete(scan);
+}
+
+static void* DirScan_Thd(struct DirScan* scan) {
+	DIR* dir = opendir(scan->path);
+	List files = List_New();
+	List folders = List_New();
+	const struct dirent* entry;
+	int num = 0;
+	
+	while (dir && !scan->cancel && (entry = readdir(dir))) {
+		const char* name = entry->d_name;
+		
+		if (!strcmp(name, ".") || !strcmp(name, ".."))
+			continue;
+		
+		if (DirScan_IsFolder(scan, entry)) {
+			char buf[PATH_BUFFER_SIZE];
+			
+			snprintf(buf, PATH_BUFFER_SIZE, "%s/", name);
+			List_Add(&folders, buf);
+		} else if (DirScan_Match(scan, name))
+			List_Add(&files, name);
+		else
+			continue;
+		
+		if (++num % DIR_SCAN_BATCH == 0) {
+			mutex_scope(scan->mutex, {
+				DirScan_Move(&scan->files, &files);
+				DirScan_Move(&scan->folders, &folders);
+			});
+		}
+	}
+	
+	if (dir)
+		closedir(dir);
+	
+	mutex_scope(scan->mutex, {
+		DirScan_Move(&scan->files, &files);
+		DirScan_Move(&scan->folders, &folders);
+		scan->done = true;
+	});
+	
+	List_Free(&files);
+	List_Free(&folders);
+	DirScan_Release(scan);
+	
+	return NULL;
+}
+
+static void DirScan_Start(FileDialog* this) {
+	struct DirScan* scan = new(struct DirScan);
+	
+	DirScan_Path(scan->path, this->path);
+	scan->mtime = sys_stat(this->path);
+	scan->refs = 2;
+	scan->files = List_New();
+	scan->folders = List_New();
+	mutex_init(&scan->mutex);
+	
+	if (this->filter) {
+		scan->filter = new(List);
+		*scan->filter = List_New();
+		forlist(item, *this->filter)
+			List_Add(scan->filter, item);
+	}
+	
+	if (thd_create(&scan->thd, DirScan_Thd, scan))
+		errr("Could not start scanning [%s]", this->path);
+	thd_detach(&scan->thd);
+	this->scan = scan;
+}
+
+/**
+ * Never waits for the worker, it can be stuck in opendir or readdir on a
+ * slow mount. A cancelled worker frees the scan once it gets back.
+ */
+static void DirScan_Stop(FileDialog* this) {
+	struct DirScan* scan = this->scan;
+	
+	if (!scan)
+		return;
+	
+	scan->cancel = true;
+	this->scan = NULL;
+	DirScan_Release(scan);
+}
+
+/**
+ * Merges the sorted batch into the sorted list in place of a full sort,
+ * remap receives the new position of every old item.
+ */
+static void DirScan_Merge(List* list, List* batch, int* remap) {
+	char** item;
+	int i = 0, j = 0, k = 0;
+	
+	List_Sort(batch);
+	item = new(char*[list->num + batch->num + 1]);
+	
+	while (i < list->num || j < batch->num) {
+		if (j == batch->num || (i < list->num && qsort_numhex(&list->item[i], &batch->item[j]) <= 0)) {
+			remap[i] = k;
+			item[k++] = list->item[i++];
+		} else
+			item[k++] = batch->item[j++];
+	}
+	
+	delete(list->item, batch->item);
+	list->item = item;
+	list->num = k;
+	list->p.alnum = 0;
+	batch->num = 0;
+	batch->p.alnum = 0;
+}
+
+static DirCache* DirCache_Find(const char* path, const char* filter) {
+	for (int i = 0; i < DIR_CACHE_NUM; i++)
+		if (sDirCache[i].path && streq(sDirCache[i].path, path) && streq(sDirCache[i].filter, filter))
+			return &sDirCache[i];
+	
+	return NULL;
+}
+
+static void DirCache_CopyList(List* dst, List* src) {
+	List_Free(dst);
+	List_Alloc(dst, src->num);
+	
+	for (int i = 0; i < src->num; i++)
+		List_Add(dst, src->item[i]);
+}
+
+static char* DirCache_FilterKey(FileDialog* this) {
+	char* key = this->filter ? List_Concat(this->filter, ",") : NULL;
+	
+	return key ? key : strdup("");
+}
+
+// Directory mtime changes whenever an entry is added, removed or renamed
+static bool DirCache_Get(FileDialog* this) {
+	char* key = DirCache_FilterKey(this);
+	char path[PATH_BUFFER_SIZE];
+	DirCache* c;
+	
+	DirScan_Path(path, this->path);
+	c = DirCache_Find(path, key);
+	
+	delete(key);
+	if (!c || c->mtime != sys_stat(this->path))
+		return false;
+	
+	DirCache_CopyList(&this->files, &c->files);
+	DirCache_CopyList(&this->folders, &c->folders);
+	
+	return true;
+}
+
+static void DirCache_Set(FileDialog* this) {
+	char* key = DirCache_FilterKey(this);
+	DirCache* c = DirCache_Find(this->scan->path, key);
+	
+	if (!c) {
+		c = &sDirCache[sDirCacheNext++ % DIR_CACHE_NUM];
+		delete(c->path, c->filter);
+		c->path = strdup(this->scan->path);
+		c->filter = key;
+	} else
+		delete(key);
+	
+	c->mtime = this->scan->mtime;
+	DirCache_CopyList(&c->files, &this->files);
+	DirCache_CopyList(&c->folders, &this->folders);
+}
+
+/**
+ * Takes whatever the worker has found so far, so a large directory is
+ * listed while it is still being read.
+ */
+static void DirScan_Poll(FileDialog* this) {
+	struct DirScan* scan = this->scan;
+	List files = List_New();
+	List folders = List_New();
+	int oldFolders = this->folders.num;
+	int* remapFolder;
+	int* remapFile;
+	bool done;
+	
+	if (!scan)
+		return;
+	
+	mutex_scope(scan->mutex, {
+		DirScan_Move(&files, &scan->files);
+		DirScan_Move(&folders, &scan->folders);
+		done = scan->done;
+	});
+	
+	if (files.num || folders.num) {
+		remapFolder = new(int[this->folders.num + 1]);
+		remapFile = new(int[this->files.num + 1]);
+		
+		DirScan_Merge(&this->folders, &folders, remapFolder);
+		DirScan_Merge(&this->files, &files, remapFile);
+		
+		for (int i = 0; i < this->index.num; i++) {
+			int* k = Arli_At(&this->index, i);
+			
+			if (*k < oldFolders)
+				*k = remapFolder[*k];
+			else
+				*k = this->folders.num + remapFile[*k - oldFolders];
+		}
+		
+		delete(remapFolder, remapFile);
+		CullItems(this);
+	}
+	
+	if (done) {
+		DirCache_Set(this);
+		DirScan_Stop(this);
+	} else
+		Window_RequestRedraw(GET_WINDOW());
+}
+
 static void ReadPath(FileDialog* this, const char* path) {
 	if (!path) return;
 	if (!sys_isdir(path)) {
@@ -226,35 +559,19 @@ static void ReadPath(FileDialog* this, const char* path) {
 	if (this->path != path)
 		strncpy(this->path, path, PATH_BUFFER_SIZE);
 	
+	DirScan_Stop(this);
 	List_Free(&this->files);
 	List_Free(&this->folders);
 	
-	if (this->filter) {
-		List* list = this->filter;
-		
-		for (int i = 0; i < list->num; i++) {
-			FilterNode* node = new(FilterNode);
-			node->type = CONTAIN_END;
-			node->txt = strdup(list->item[i]);
-			
-			Node_Add(this->files.filterNode, node);
-		}
-	}
-	
-	List_Walk(&this->files, this->path, 0, LIST_FILES | LIST_RELATIVE);
-	List_Walk(&this->folders, this->path, 0, LIST_FOLDERS | LIST_RELATIVE);
-	
-	List_Sort(&this->files);
-	List_Sort(&this->folders);
-	
-	delete(this->searchFilterFlagList);
-	this->searchFilterFlagList = new(s8[this->files.num + this->folders.num + 1]);
+	if (!DirCache_Get(this))
+		DirScan_Start(this);
 	
 	Element_Textbox_SetText(&this->search.path, this->path);
 	
 	Input* input = GET_INPUT();
 	
 	ClearSelections(this);
+	CullItems(this);
 	Input_SetTempLock(input, 2);
 }
 
@@ -360,11 +677,13 @@ static void Draw_SidePanel(FileDialog* this, ContextMenu* context, Rect mainRect
 static void Draw_FilePanel(FileDialog* this, ContextMenu* context, Rect mainRect, void* vg) {
 	Input* input = GET_INPUT();
 	Rect scrollRect = Rect_Scale(mainRect, -SPLIT_ELEM_X_PADDING * 2, -SPLIT_ELEM_X_PADDING * 2);
-	int num = (this->folders.num + this->files.num) - this->searchFilterNum;
+	int num;
 	int j = 0;
 	bool inputAccess = DummySplit_InputAcces(&this->nano, this->split[2], &mainRect);
 	Rect select = Rect_Vec2x2(input->cursor.pressPos, input->cursor.pos);
 	
+	DirScan_Poll(this);
+	num = (this->folders.num + this->files.num) - this->searchFilterNum;
 	ScrollBar_Init(&this->scroll, num, SPLIT_TEXT_H);
 	if (ScrollBar_Update(&this->scroll, input, input->cursor.pos, scrollRect, mainRect))
 		inputAccess = false;
@@ -682,6 +1001,7 @@ static void Destroy(NanoGrid* mainGrid, ContextMenu* context) {
 	struct SidePanel* bookmarks = &this->bookmarks;
 	
 	SaveConfig(this);
+	DirScan_Stop(this);
 	
 	Arli_Free(&volumes->list);
 	Arli_Free(&bookmarks->list);
@@ -1265,6 +1265,7 @@ void NanoGrid_TaskTable(NanoGrid* nano, SplitTask** taskTable, u32 num) {
 }
 
 extern void* ElementState_New(void);
+extern void ElementState_Free(void* elemState);
 extern void ElementState_Set(void* elemState);
 extern void* ElementState_Get();
 extern void Element_Flush(NanoGrid* nano);
@@ -1313,7 +1314,8 @@ void NanoGrid_Destroy(NanoGrid* this) {
 		Node_Kill(this->edgeHead, this->edgeHead);
 	
 	osLog("delete ElemState");
-	delete(this->elemState);
+	ElementState_Free(this->elemState);
+	this->elemState = NULL;
 }
 
 void NanoGrid_Update(NanoGrid* this) {
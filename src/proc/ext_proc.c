@@ -388,3 +388,240 @@ int Proc_Join(Proc* this) {
 	
 	return Proc_Free(this);
 }
+
+/*============================================================================*/
+
+typedef struct {
+	Proc*   proc;
+	Memfile line[2];
+	int     open;
+	bool    exited;
+} ProcSlot;
+
+void ProcPool_Init(ProcPool* this, u32 max, bool lineMode) {
+	*this = (ProcPool) {
+		.queue    = Arli_New(Proc*),
+		.max      = max ? max : sys_getcorenum(),
+		.lineMode = lineMode,
+	};
+}
+
+/**
+ * onOutput: void (*)(void* udata, Proc* proc, e_ProcRead target, const char* data, size_t size)
+ * onExit:   void (*)(void* udata, Proc* proc, int signal)
+ *
+ * In line mode onOutput gets one line at a time without the newline,
+ * otherwise it gets the chunks as they are read. Both are called from
+ * the thread running ProcPool_Run.
+ */
+void ProcPool_SetCallback(ProcPool* this, void* onOutput, void* onExit, void* udata) {
+	this->onOutput = onOutput;
+	this->onExit = onExit;
+	this->udata = udata;
+}
+
+// The pool takes ownership, proc is joined and freed after it exits
+void ProcPool_Add(ProcPool* this, Proc* proc) {
+	Arli_Add(&this->queue, &proc);
+}
+
+void ProcPool_Free(ProcPool* this) {
+	for (int i = 0; i < this->queue.num; i++) {
+		Proc* proc = *(Proc**)Arli_At(&this->queue, i);
+		
+		// Never started, there is no thread or child to kill
+		proc->state &= ~(PROC_THROW_ERROR | PROC_SYSTEM_EXE);
+		Proc_Join(proc);
+	}
+	
+	Arli_Free(&this->queue);
+}
+
+static void ProcPool_Output(ProcPool* this, ProcSlot* slot, e_ProcRead target, const char* data, size_t size) {
+	Memfile* line = &slot->line[target];
+	
+	if (!this->onOutput)
+		return;
+	
+	if (!this->lineMode) {
+		if (size)
+			this->onOutput(this->udata, slot->proc, target, data, size);
+		
+		return;
+	}
+	
+	// size 0 flushes what is left of the last line
+	if (!size) {
+		if (line->size) {
+			Memfile_Write(line, "\0", 1);
+			this->onOutput(this->udata, slot->proc, target, line->str, line->size - 1);
+		}
+		Memfile_Null(line);
+		
+		return;
+	}
+	
+	for (const char* end; (end = memchr(data, '\n', size));) {
+		size_t len = end - data;
+		
+		Memfile_Write(line, data, len);
+		Memfile_Write(line, "\0", 1);
+		len = line->size - 1;
+		if (len && line->str[len - 1] == '\r')
+			line->str[--len] = '\0';
+		
+		this->onOutput(this->udata, slot->proc, target, line->str, len);
+		Memfile_Null(line);
+		
+		size -= end + 1 - data;
+		data = end + 1;
+	}
+	
+	if (size)
+		Memfile_Write(line, data, size);
+}
+
+static void ProcPool_Start(ProcPool* this, ProcSlot* slot, Proc* proc) {
+	proc->state &= ~(PROC_SYSTEM_EXE | PROC_OPEN_STDIN);
+	proc->state |= PROC_MUTE;
+	
+	*slot = (ProcSlot) {
+		.proc    = proc,
+		.line[0] = Memfile_New(),
+		.line[1] = Memfile_New(),
+		.open    = REPROC_EVENT_OUT | REPROC_EVENT_ERR | REPROC_EVENT_EXIT,
+	};
+	
+	if (Proc_Exec(proc))
+		slot->open = 0;
+}
+
+static int ProcPool_Finish(ProcPool* this, ProcSlot* slot) {
+	int signal;
+	
+	ProcPool_Output(this, slot, READ_STDOUT, NULL, 0);
+	ProcPool_Output(this, slot, READ_STDERR, NULL, 0);
+	
+	signal = reproc_wait(slot->proc->proc, REPROC_INFINITE);
+	
+	if (this->onExit)
+		this->onExit(this->udata, slot->proc, signal);
+	
+	Memfile_Free(&slot->line[0]);
+	Memfile_Free(&slot->line[1]);
+	Proc_Join(slot->proc);
+	slot->proc = NULL;
+	
+	return signal != 0;
+}
+
+/**
+ * Runs the queued processes, at most max at a time, and waits for all
+ * of them. Output of every running child is multiplexed with reproc_poll
+ * on this thread, a finished child is replaced from the queue right
+ * away. Under a make jobserver every child next to the first one takes
+ * a token. Returns the number of processes that failed or exited non zero.
+ */
+int ProcPool_Run(ProcPool* this) {
+	ProcSlot* slot = new(ProcSlot[this->max]);
+	reproc_event_source* src = new(reproc_event_source[this->max]);
+	u32 next = 0;
+	u32 numRun = 0;
+	u32 token = 0;
+	int fail = 0;
+	
+	while (next < this->queue.num || numRun) {
+		bool starved = false;
+		int r;
+		
+		for (u32 i = 0; i < this->max; i++) {
+			if (slot[i].proc || next >= this->queue.num)
+				continue;
+			
+			// Children next to the first one run on a jobserver token
+			if (numRun) {
+				if (!Jobserver_Acquire(0)) {
+					starved = true;
+					break;
+				}
+				token++;
+			}
+			
+			ProcPool_Start(this, &slot[i], *(Proc**)Arli_At(&this->queue, next++));
+			numRun++;
+		}
+		
+		for (u32 i = 0; i < this->max; i++) {
+			src[i] = (reproc_event_source) {
+				.process   = slot[i].proc ? slot[i].proc->proc : NULL,
+				.interests = slot[i].proc ? slot[i].open : 0,
+			};
+			
+			// Failed to start or fully drained
+			if (slot[i].proc && !(slot[i].open & (REPROC_EVENT_OUT | REPROC_EVENT_ERR))) {
+				if (slot[i].exited || !(slot[i].open & REPROC_EVENT_EXIT)) {
+					fail += ProcPool_Finish(this, &slot[i]);
+					src[i].process = NULL;
+					numRun--;
+					
+					if (token && token >= numRun) {
+						Jobserver_Release();
+						token--;
+					}
+				}
+			}
+		}
+		
+		if (!numRun || (next < this->queue.num && numRun < this->max && !starved))
+			continue;
+		
+		// While short on tokens check back for one every now and then
+		r = reproc_poll(src, this->max, starved ? 20 : REPROC_INFINITE);
+		
+		if (r == 0)
+			continue;
+		
+		if (r < 0) {
+			// Nothing left to poll, the remaining children have closed their pipes
+			for (u32 i = 0; i < this->max; i++)
+				if (slot[i].proc)
+					slot[i].open = 0;
+			continue;
+		}
+		
+		for (u32 i = 0; i < this->max; i++) {
+			const struct { int event; REPROC_STREAM stream; e_ProcRead target; } pipe[] = {
+				{ REPROC_EVENT_OUT, REPROC_STREAM_OUT, READ_STDOUT },
+				{ REPROC_EVENT_ERR, REPROC_STREAM_ERR, READ_STDERR },
+			};
+			
+			if (!src[i].process)
+				continue;
+			
+			for (int k = 0; k < 2; k++) {
+				u8 buffer[4096];
+				int r;
+				
+				if (!(src[i].events & pipe[k].event))
+					continue;
+				
+				r = reproc_read(slot[i].proc->proc, pipe[k].stream, buffer, sizeof(buffer));
+				
+				if (r > 0)
+					ProcPool_Output(this, &slot[i], pipe[k].target, (char*)buffer, r);
+				else if (r < 0 && r != REPROC_EWOULDBLOCK)
+					slot[i].open &= ~pipe[k].event;
+			}
+			
+			if (src[i].events & REPROC_EVENT_EXIT) {
+				slot[i].exited = true;
+				slot[i].open &= ~REPROC_EVENT_EXIT;
+			}
+		}
+	}
+	
+	Arli_Clear(&this->queue);
+	delete(slot, src);
+	
+	return fail;
+}
@@ -5,37 +5,429 @@
 #include <regex.h>
 #endif
 
-char* regex(const char* str, const char* pattern, enum RegexFlag flag) {
-	regex_t reg;
-	regmatch_t* match;
-	u32 matchNum = 0;
-	char* ret = NULL;
+_Static_assert(sizeof(RegexMatch) == sizeof(regmatch_t), "RegexMatch has to mirror regmatch_t");
+
+/*============================================================================*/
+
+/**
+ * Finds the literal run every match has to start with. Alternation, case
+ * folding or anything but plain characters up front means there is none.
+ */
+static void Regex_FindLiteral(Regex* this, const char* pattern, int flags) {
+	char lit[256];
+	u32 len = 0;
+	const char* p = pattern;
 	
-	if (flag & REGFLAG_MATCH_NUM)
-		matchNum = (flag & REGFLAG_NUMMASK );
+	if (flags & REGEX_ICASE || strchr(pattern, '|'))
+		return;
 	
-	match = malloc(sizeof(regmatch_t) * (matchNum + 1));
+	if (*p == '^')
+		p++;
 	
-	if (regcomp(&reg, pattern, REG_EXTENDED)) {
+	while (*p && len < sizeof(lit)) {
+		if (strchr(".[]()*+?{}^$", *p))
+			break;
+		
+		if (*p == '\\') {
+			if (!p[1] || isalnum(p[1]))
+				break;
+			p++;
+		}
+		
+		lit[len++] = *p++;
+	}
+	
+	// The last character may be optional
+	if (len && (*p == '*' || *p == '?' || *p == '{'))
+		len--;
+	
+	if (len) {
+		this->lit = strndup(lit, len);
+		this->litLen = len;
+	}
+}
+
+// Extended syntax, returns non zero and leaves this empty on failure
+int Regex_Compile(Regex* this, const char* pattern, int flags) {
+	int cflags = REG_EXTENDED;
+	int r;
+	
+	*this = (Regex) {};
+	
+	if (flags & REGEX_ICASE)
+		cflags |= REG_ICASE;
+	if (flags & REGEX_NEWLINE)
+		cflags |= REG_NEWLINE;
+	
+	this->reg = new(regex_t);
+	
+	if ((r = regcomp(this->reg, pattern, cflags))) {
 		warn("regex: compilation error");
 		warn("pattern: \"%s\"", pattern);
-		goto done;
+		delete(this->reg);
+		
+		return r;
+	}
+	
+	this->numSub = ((regex_t*)this->reg)->re_nsub;
+	Regex_FindLiteral(this, pattern, flags);
+	
+	return 0;
+}
+
+/**
+ * Fills up to num groups into match, 0 is the whole match. Groups past
+ * numSub are set to -1.
+ */
+bool Regex_Match(Regex* this, const char* str, RegexMatch* match, u32 num) {
+	if (!this->reg)
+		return false;
+	
+	return !regexec(this->reg, str, num, (regmatch_t*)match, 0);
+}
+
+/**
+ * Writes the offsets of up to max non overlapping matches in str and
+ * returns how many were found.
+ */
+u32 Regex_FindAll(Regex* this, const char* str, RegexMatch* match, u32 max) {
+	const char* p = str;
+	u32 num = 0;
+	
+	if (!this->reg)
+		return 0;
+	
+	while (num < max) {
+		regmatch_t m;
+		
+		if (regexec(this->reg, p, 1, &m, p == str ? 0 : REG_NOTBOL))
+			break;
+		
+		match[num].so = p - str + m.rm_so;
+		match[num].eo = p - str + m.rm_eo;
+		num++;
+		
+		// Empty matches still have to move forward
+		if (m.rm_eo > m.rm_so)
+			p += m.rm_eo;
+		else if (p[m.rm_so])
+			p += m.rm_so + 1;
+		else
+			break;
 	}
 	
-	if (regexec(&reg, str, matchNum + 1, match, 0))
-		goto done;
+	return num;
+}
+
+void Regex_Free(Regex* this) {
+	if (this->reg)
+		regfree(this->reg);
+	delete(this->reg, this->lit);
+	*this = (Regex) {};
+}
+
+/*============================================================================*/
+
+#define REGEX_SCAN_CHUNK MbToBin(1)
+
+typedef struct {
+	Regex* re;
+	const char* data;
+	Arli*  out;
+	char*  line;
+	size_t lineSize;
+} RegexScan;
+
+static void Regex_ScanLine(RegexScan* this, const char* line, size_t len) {
+	const u32 num = this->re->numSub + 1;
+	regmatch_t m[num];
+	const char* str = line;
+	size_t pos = 0;
+
+#ifndef REG_STARTEND
+	if (len + 1 > this->lineSize) {
+		this->lineSize = len + 1 + (len >> 1);
+		this->line = realloc(this->line, this->lineSize);
+	}
+	memcpy(this->line, line, len);
+	this->line[len] = '\0';
+	str = this->line;
+#endif
+	
+	while (pos <= len) {
+		int eflags = pos ? REG_NOTBOL : 0;
+
+#ifdef REG_STARTEND
+		m[0].rm_so = pos;
+		m[0].rm_eo = len;
+		if (regexec(this->re->reg, str, num, m, eflags | REG_STARTEND))
+			break;
+#else
+		if (regexec(this->re->reg, str + pos, num, m, eflags))
+			break;
+		
+		for (u32 i = 0; i < num; i++) {
+			if (m[i].rm_so >= 0) {
+				m[i].rm_so += pos;
+				m[i].rm_eo += pos;
+			}
+		}
+#endif
+		
+		for (u32 i = 0; i < num; i++) {
+			RegexSpan span = { -1, -1 };
+			
+			if (m[i].rm_so >= 0) {
+				span.so = line - this->data + m[i].rm_so;
+				span.eo = line - this->data + m[i].rm_eo;
+			}
+			
+			Arli_Add(this->out, &span);
+		}
+		
+		// Empty matches still have to move forward
+		if (m[0].rm_eo > m[0].rm_so)
+			pos = m[0].rm_eo;
+		else
+			pos = m[0].rm_so + 1;
+	}
+}
+
+// Walks [start, end) which begins on a line start, only lines holding the literal are matched
+static void Regex_ScanRange(RegexScan* this, const char* start, const char* end) {
+	const Regex* re = this->re;
+	const char* p = start;
+	
+	while (p < end) {
+		const char* line = p;
+		const char* eol;
+		
+		if (re->litLen) {
+			const char* hit = p;
+			
+			while ((hit = memchr(hit, re->lit[0], end - hit))) {
+				if (end - hit >= re->litLen && !memcmp(hit, re->lit, re->litLen))
+					break;
+				hit++;
+			}
+			
+			if (!hit)
+				return;
+			
+			line = hit;
+			while (line > p && line[-1] != '\n')
+				line--;
+		}
+		
+		if (!(eol = memchr(line, '\n', end - line)))
+			eol = end;
+		
+		Regex_ScanLine(this, line, eol - line);
+		p = eol + 1;
+	}
+}
+
+typedef struct {
+	Regex* re;
+	const char* data;
+	size_t size;
+	size_t* split;
+	Arli*  out;
+} RegexScanJob;
+
+static void Regex_ScanThd(RegexScanJob* this, u32 i) {
+	RegexScan scan = {
+		.re   = this->re,
+		.data = this->data,
+		.out  = &this->out[i],
+	};
+	
+	Regex_ScanRange(&scan, this->data + this->split[i], this->data + this->split[i + 1]);
+	free(scan.line);
+}
+
+/**
+ * Appends every match in data to out, an Arli of RegexSpan, as numSub + 1
+ * spans each with offsets from data. Matching is line by line like grep,
+ * no match crosses a newline. Large buffers are cut into line aligned
+ * chunks scanned on Parallel_For. Returns the number of matches added.
+ */
+size_t Regex_Scan(Regex* this, const void* data, size_t size, Arli* out) {
+	RegexScanJob job = { .re = this, .data = data, .size = size };
+	size_t prev = out->num;
+	u32 num = 0;
+	
+	osAssert(out->elemSize == sizeof(RegexSpan));
+	
+	if (!this->reg || !size)
+		return 0;
+	
+	job.split = new(size_t[size / REGEX_SCAN_CHUNK + 2]);
+	
+	for (size_t p = 0; p < size;) {
+		size_t e = Min(p + REGEX_SCAN_CHUNK, size);
+		const char* nl;
+		
+		if (e < size && (nl = memchr(job.data + e, '\n', size - e)))
+			e = nl - job.data + 1;
+		else if (e < size)
+			e = size;
+		
+		job.split[num++] = p;
+		p = e;
+	}
+	job.split[num] = size;
+	
+	job.out = new(Arli[num]);
+	for (u32 i = 0; i < num; i++)
+		job.out[i] = Arli_New(RegexSpan);
+	
+	Parallel_For(num, 0, Regex_ScanThd, &job);
+	
+	for (u32 i = 0; i < num; i++) {
+		if (job.out[i].num)
+			Arli_AddN(out, job.out[i].num, job.out[i].begin);
+		Arli_Free(&job.out[i]);
+	}
+	
+	delete(job.split, job.out);
+	
+	return (out->num - prev) / (this->numSub + 1);
+}
+
+size_t Regex_ScanMem(Regex* this, Memfile* mem, Arli* out) {
+	return Regex_Scan(this, mem->data, mem->size, out);
+}
+
+/*============================================================================*/
+
+#define REGEX_CACHE_NUM 32
+
+typedef struct {
+	char* pattern;
+	int   flags;
+	Regex re;
+	u32   refs;
+	u64   tick;
+} RegexCache;
+
+static RegexCache sRegexCache[REGEX_CACHE_NUM];
+static mutex_t sRegexMutex = PTHREAD_MUTEX_INITIALIZER;
+static u64 sRegexTick;
+
+/**
+ * Returns the compiled pattern from the cache, compiling it into the
+ * least recently used slot on a miss. Slots in use by another thread
+ * are never evicted, if all of them are busy the pattern is compiled
+ * uncached and freed by RegexCache_Put.
+ */
+static RegexCache* RegexCache_Get(const char* pattern, int flags) {
+	RegexCache* slot = NULL;
+	RegexCache* e;
+	
+	pthread_mutex_lock(&sRegexMutex);
+	
+	for (int i = 0; i < REGEX_CACHE_NUM; i++) {
+		e = &sRegexCache[i];
+		
+		if (e->pattern && e->flags == flags && !strcmp(e->pattern, pattern)) {
+			e->refs++;
+			e->tick = ++sRegexTick;
+			pthread_mutex_unlock(&sRegexMutex);
+			
+			return e;
+		}
+		
+		if (!e->refs && (!slot || e->tick < slot->tick))
+			slot = e;
+	}
+	
+	if (!slot) {
+		pthread_mutex_unlock(&sRegexMutex);
+		
+		slot = new(RegexCache);
+		if (Regex_Compile(&slot->re, pattern, flags)) {
+			delete(slot);
+			
+			return NULL;
+		}
+		
+		return slot;
+	}
+	
+	if (slot->pattern) {
+		Regex_Free(&slot->re);
+		delete(slot->pattern);
+	}
+	
+	if (Regex_Compile(&slot->re, pattern, flags)) {
+		slot->pattern = NULL;
+		slot->tick = 0;
+		pthread_mutex_unlock(&sRegexMutex);
+		
+		return NULL;
+	}
+	
+	slot->pattern = strdup(pattern);
+	slot->flags = flags;
+	slot->refs = 1;
+	slot->tick = ++sRegexTick;
+	pthread_mutex_unlock(&sRegexMutex);
+	
+	return slot;
+}
+
+static void RegexCache_Put(RegexCache* e) {
+	if (e < sRegexCache || e >= sRegexCache + REGEX_CACHE_NUM) {
+		Regex_Free(&e->re);
+		delete(e);
+		
+		return;
+	}
+	
+	pthread_mutex_lock(&sRegexMutex);
+	e->refs--;
+	pthread_mutex_unlock(&sRegexMutex);
+}
+
+onexit_func_t RegexCache_Dest() {
+	for (int i = 0; i < REGEX_CACHE_NUM; i++) {
+		if (!sRegexCache[i].pattern)
+			continue;
+		
+		Regex_Free(&sRegexCache[i].re);
+		delete(sRegexCache[i].pattern);
+	}
+}
+
+/*============================================================================*/
+
+char* regex(const char* str, const char* pattern, enum RegexFlag flag) {
+	RegexCache* e = RegexCache_Get(pattern, 0);
+	u32 matchNum = 0;
+	char* ret = NULL;
+	
+	if (!e)
+		return NULL;
+	
+	if (flag & REGFLAG_MATCH_NUM)
+		matchNum = (flag & REGFLAG_NUMMASK );
 	
-	if (flag & REGFLAG_START) {
-		ret = (char*)str + match[matchNum].rm_so;
-	} else if (flag & REGFLAG_END) {
-		ret = (char*)str + match[matchNum].rm_eo;
-	} else if (flag & REGFLAG_COPY) {
-		ret = strndup(str + match[matchNum].rm_so, match[matchNum].rm_eo - match[matchNum].rm_so);
+	if (matchNum <= e->re.numSub) {
+		RegexMatch match[matchNum + 1];
+		
+		if (Regex_Match(&e->re, str, match, matchNum + 1) && match[matchNum].so >= 0) {
+			if (flag & REGFLAG_START) {
+				ret = (char*)str + match[matchNum].so;
+			} else if (flag & REGFLAG_END) {
+				ret = (char*)str + match[matchNum].eo;
+			} else if (flag & REGFLAG_COPY) {
+				ret = strndup(str + match[matchNum].so, match[matchNum].eo - match[matchNum].so);
+			}
+		}
 	}
 	
-	done:
-	regfree(&reg);
-	delete(match);
+	RegexCache_Put(e);
 	
 	return ret;
 }
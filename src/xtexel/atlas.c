@@ -0,0 +1,235 @@
+#include <ext_texel.h>
+
+/*============================================================================*/
+
+static void AtlasPage_Init(AtlasPage* this, int w, int h) {
+	this->img = Image_New();
+	this->img.data = new(u8[w * h * 4]);
+	this->img.x = w;
+	this->img.y = h;
+	this->img.channels = 4;
+	this->img.memSize = this->img.size = w * h * 4;
+	
+	this->node = new(AtlasNode[w + 1]);
+	this->node[0] = (AtlasNode) { 0, 0, w };
+	this->numNode = 1;
+	this->dirty = true;
+}
+
+/**
+ * Height of the skyline under [x, x + w) starting at node i,
+ * -1 if it does not fit.
+ */
+static int AtlasPage_Fit(AtlasPage* this, int i, int w, int h) {
+	int x = this->node[i].x;
+	int y = 0;
+	
+	if (x + w > this->img.x)
+		return -1;
+	
+	for (int left = w; left > 0; i++) {
+		y = Max(y, this->node[i].y);
+		if (y + h > this->img.y)
+			return -1;
+		left -= this->node[i].w;
+	}
+	
+	return y;
+}
+
+// Bottom left skyline, least wasted height wins ties
+static bool AtlasPage_Pack(AtlasPage* this, int w, int h, int* ox, int* oy) {
+	int best = -1;
+	int bestY = INT32_MAX;
+	int bestW = INT32_MAX;
+	AtlasNode* n;
+	
+	for (int i = 0; i < this->numNode; i++) {
+		int y = AtlasPage_Fit(this, i, w, h);
+		
+		if (y < 0)
+			continue;
+		
+		if (y + h < bestY || (y + h == bestY && this->node[i].w < bestW)) {
+			best = i;
+			bestY = y + h;
+			bestW = this->node[i].w;
+		}
+	}
+	
+	if (best < 0)
+		return false;
+	
+	*ox = this->node[best].x;
+	*oy = bestY - h;
+	
+	memmove(&this->node[best + 1], &this->node[best], sizeof(AtlasNode) * (this->numNode - best));
+	this->node[best] = (AtlasNode) { *ox, bestY, w };
+	this->numNode++;
+	
+	// Trim the nodes now covered by the new one
+	for (int i = best + 1; i < this->numNode; i++) {
+		AtlasNode* prev = &this->node[i - 1];
+		int shrink;
+		
+		n = &this->node[i];
+		shrink = prev->x + prev->w - n->x;
+		
+		if (shrink <= 0)
+			break;
+		
+		n->x += shrink;
+		n->w -= shrink;
+		
+		if (n->w > 0)
+			break;
+		
+		memmove(n, n + 1, sizeof(AtlasNode) * (this->numNode - i - 1));
+		this->numNode--;
+		i--;
+	}
+	
+	for (int i = 0; i < this->numNode - 1; i++) {
+		n = &this->node[i];
+		
+		if (n->y == n[1].y) {
+			n->w += n[1].w;
+			memmove(n + 1, n + 2, sizeof(AtlasNode) * (this->numNode - i - 2));
+			this->numNode--;
+			i--;
+		}
+	}
+	
+	return true;
+}
+
+/*============================================================================*/
+
+void Atlas_Init(Atlas* this, int w, int h, int padding, bool extrude) {
+	*this = (Atlas) {
+		.w       = w,
+		.h       = h,
+		.padding = padding,
+		.extrude = extrude,
+		.entry   = Arli_New(AtlasEntry),
+	};
+}
+
+void Atlas_Free(Atlas* this) {
+	for (int i = 0; i < this->numPage; i++) {
+		Image_Free(&this->page[i].img);
+		delete(this->page[i].node);
+	}
+	
+	delete(this->page);
+	Arli_Free(&this->entry);
+	*this = (Atlas) {};
+}
+
+static void Atlas_Blit(Atlas* this, AtlasPage* page, const u8* rgba, int x, int y, int w, int h) {
+	const int pw = page->img.x;
+	const int pad = this->padding;
+	u8* data = page->img.data;
+	
+	for (int j = 0; j < h; j++)
+		memcpy(&data[((y + j) * pw + x) * 4], &rgba[j * w * 4], w * 4);
+	
+	if (!this->extrude || !pad)
+		return;
+	
+	// Repeat the edge pixels into the padding so filtering does not bleed
+	for (int j = 0; j < h; j++) {
+		u32* row = (u32*)&data[(y + j) * pw * 4];
+		
+		for (int k = 1; k <= pad; k++) {
+			row[x - k] = row[x];
+			row[x + w - 1 + k] = row[x + w - 1];
+		}
+	}
+	
+	for (int k = 1; k <= pad; k++) {
+		memcpy(&data[((y - k) * pw + x - pad) * 4], &data[(y * pw + x - pad) * 4], (w + pad * 2) * 4);
+		memcpy(&data[((y + h - 1 + k) * pw + x - pad) * 4], &data[((y + h - 1) * pw + x - pad) * 4], (w + pad * 2) * 4);
+	}
+}
+
+/**
+ * Copies a w * h RGBA block into the first page it fits in, a new page
+ * is opened when none has room. Returns the entry id, or -1 when the
+ * block is larger than a page.
+ */
+int Atlas_AddRaw(Atlas* this, const u8* rgba, int w, int h) {
+	const int pad = this->padding;
+	AtlasEntry e = {};
+	int x, y;
+	int i;
+	
+	if (w + pad * 2 > this->w || h + pad * 2 > this->h)
+		return -1;
+	
+	for (i = 0; i < this->numPage; i++)
+		if (AtlasPage_Pack(&this->page[i], w + pad * 2, h + pad * 2, &x, &y))
+			break;
+	
+	if (i == this->numPage) {
+		this->page = realloc(this->page, sizeof(AtlasPage) * ++this->numPage);
+		AtlasPage_Init(&this->page[i], this->w, this->h);
+		osAssert(AtlasPage_Pack(&this->page[i], w + pad * 2, h + pad * 2, &x, &y));
+	}
+	
+	Atlas_Blit(this, &this->page[i], rgba, x + pad, y + pad, w, h);
+	this->page[i].dirty = true;
+	
+	e.page = i;
+	e.rect = Rect_New(x + pad, y + pad, w, h);
+	e.u0 = (f32)e.rect.x / this->w;
+	e.v0 = (f32)e.rect.y / this->h;
+	e.u1 = (f32)(e.rect.x + w) / this->w;
+	e.v1 = (f32)(e.rect.y + h) / this->h;
+	Arli_Add(&this->entry, &e);
+	
+	return this->entry.num - 1;
+}
+
+int Atlas_Add(Atlas* this, Image* img) {
+	Image tmp = Image_New();
+	int id;
+	
+	if (img->channels == 4)
+		return Atlas_AddRaw(this, img->data, img->x, img->y);
+	
+	Image_ToRGBA(&tmp, img);
+	id = Atlas_AddRaw(this, tmp.data, tmp.x, tmp.y);
+	Image_Free(&tmp);
+	
+	return id;
+}
+
+/**
+ * Adds num images tallest first, which packs noticeably tighter than
+ * adding them in arbitrary order. Ids are written to id in input order.
+ */
+void Atlas_AddList(Atlas* this, Image* img, int num, int* id) {
+	int* order = new(int[num]);
+	
+	for (int i = 0; i < num; i++)
+		order[i] = i;
+	
+	nested(int, cmp, (const void* a, const void* b)) {
+		return img[*(int*)b].y - img[*(int*)a].y;
+	};
+	
+	qsort(order, num, sizeof(int), (void*)cmp);
+	
+	for (int i = 0; i < num; i++)
+		id[order[i]] = Atlas_Add(this, &img[order[i]]);
+	
+	delete(order);
+}
+
+AtlasEntry* Atlas_Get(Atlas* this, int id) {
+	if (id < 0 || id >= this->entry.num)
+		return NULL;
+	
+	return Arli_At(&this->entry, id);
+}
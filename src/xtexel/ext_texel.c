@@ -14,6 +14,10 @@
 
 #include <ext_texel.h>
 
+#define MINIZ_HEADER_FILE_ONLY
+#define MINIZ_NO_ZLIB_COMPATIBLE_NAMES
+#include "../xzip/impl/miniz.h"
+
 #define TEX_KEY "OKKek2ldMHXTqEpmI10\0"
 
 static const char sTexKey[20] = TEX_KEY;
@@ -37,33 +41,380 @@ Image Image_New(void) {
 	return sDefaultImg;
 }
 
+/**
+ * Takes over a decoded stbi buffer. If the image already owns a large
+ * enough buffer the pixels are copied into it and the decoded one freed.
+ */
+static void Image_Adopt(Image* this, u8* data, int x, int y, int channels) {
+	u32 size = x * y * channels;
+	
+	if (this->data && this->memSize >= size) {
+		memcpy(this->data, data, size);
+		stbi_image_free(data);
+	} else {
+		if (this->type != 'r')
+			delete(this->data);
+		this->data = data;
+		this->memSize = size;
+	}
+	
+	this->x = x;
+	this->y = y;
+	this->channels = channels;
+	this->size = size;
+}
+
 void Image_Load(Image* this, const char* file) {
-	uint8_t* data;
+	u8* data;
+	int x, y, n;
 	
 	osLog("Image_Load: %s", file);
 	Image_Validate(this);
 	
-	data = stbi_load(file, &this->x, &this->y, &this->channels, 4);
-	if (!data && this->throwError) errr("Failed to load texel [%s]", file);
-	
-	if (!this->data) this->data = data;
-	else {
-		memcpy(this->data, data, this->channels * this->x * this->y);
-		delete(data);
+	data = stbi_load(file, &x, &y, &n, 4);
+	if (!data) {
+		if (this->throwError) errr("Failed to load texel [%s]", file);
+		return;
 	}
 	
-	this->size = this->x * this->y * this->channels;
+	Image_Adopt(this, data, x, y, 4);
 	this->type = 'l';
 }
 
+typedef struct {
+	Image*       out;
+	const char** file;
+	const char** error;
+	int channels;
+	vu32 fail;
+} ImageBatch;
+
+static void Image_LoadBatchThd(ImageBatch* this, u32 i) {
+	Image* img = &this->out[i];
+	int x, y, n;
+	u8* data;
+	
+	data = stbi_load(this->file[i], &x, &y, &n, this->channels);
+	
+	if (!data) {
+		if (this->error)
+			this->error[i] = stbi_failure_reason();
+		__atomic_add_fetch(&this->fail, 1, __ATOMIC_RELAXED);
+		
+		return;
+	}
+	
+	if (this->error)
+		this->error[i] = NULL;
+	
+	Image_Adopt(img, data, x, y, this->channels ? this->channels : n);
+	img->type = 'l';
+}
+
+/**
+ * Decodes num files into out in parallel. Images that already own a big
+ * enough buffer are decoded into it, others receive a new buffer.
+ * channels 0 keeps the channel count of each file. Failures do not throw,
+ * their reason is written to error[i] if error is given.
+ *
+ * Returns the number of files that failed to load.
+ */
+int Image_LoadBatch(Image* out, const char** file, int num, int channels, const char** error) {
+	ImageBatch batch = {
+		.out      = out,
+		.file     = file,
+		.error    = error,
+		.channels = channels,
+	};
+	
+	osAssert(channels >= 0 && channels <= 4);
+	osLog("Image_LoadBatch: %d files", num);
+	
+	for (int i = 0; i < num; i++)
+		Image_Validate(&out[i]);
+	
+	Parallel_For(num, 0, Image_LoadBatchThd, &batch);
+	
+	return batch.fail;
+}
+
+/*============================================================================*/
+
+typedef u8 u8x16 __attribute__((vector_size(16), aligned(1)));
+typedef u16 u16x16 __attribute__((vector_size(32)));
+typedef s16 s16x16 __attribute__((vector_size(32)));
+typedef u32 u32x16 __attribute__((vector_size(64)));
+
+#define PNG_BLOCK_SIZE (256 * 1024)
+#define PNG_DICT_SIZE  (32 * 1024)
+#define PNG_ROW_PAD    32
+
+typedef struct {
+	const u8* data;
+	u8*  filt;
+	int  y;
+	int  stride;
+	int  bpp;
+} PngFilterCtx;
+
+typedef struct {
+	const u8* filt;
+	size_t    size;
+	u32  num;
+	u32  flags;
+	struct {
+		Memfile mem;
+		u32     skip;
+		u32     adler;
+		u32     adlerLen;
+	}* block;
+} PngDeflateCtx;
+
+static void Png_U32(u8* dst, u32 v) {
+	dst[0] = v >> 24;
+	dst[1] = v >> 16;
+	dst[2] = v >> 8;
+	dst[3] = v;
+}
+
+static u8x16 Png_Paeth(u8x16 a, u8x16 b, u8x16 c) {
+	s16x16 sa = __builtin_convertvector(a, s16x16);
+	s16x16 sb = __builtin_convertvector(b, s16x16);
+	s16x16 sc = __builtin_convertvector(c, s16x16);
+	s16x16 pa = sb - sc;
+	s16x16 pb = sa - sc;
+	s16x16 pc = pa + pb;
+	s16x16 ma, mb;
+	
+	pa = (pa ^ (pa >> 15)) - (pa >> 15);
+	pb = (pb ^ (pb >> 15)) - (pb >> 15);
+	pc = (pc ^ (pc >> 15)) - (pc >> 15);
+	
+	ma = (pa <= pb) & (pa <= pc);
+	mb = ~ma & (pb <= pc);
+	
+	return __builtin_convertvector((sa & ma) | (sb & mb) | (sc & ~(ma | mb)), u8x16);
+}
+
+static inline u32 Png_Cost(u8x16 v, u8x16 mask) {
+	u8x16 n = -v;
+	u8x16 m = v < n;
+	u32x16 w = __builtin_convertvector(((v & m) | (n & ~m)) & mask, u32x16);
+	u32 sum = 0;
+	
+	for (int i = 0; i < 16; i++)
+		sum += w[i];
+	
+	return sum;
+}
+
+/**
+ * Tries all five filters on each row and keeps the one with the smallest
+ * sum of absolute signed residuals, the usual PNG heuristic.
+ */
+static void Png_FilterRows(PngFilterCtx* this, u32 band) {
+	const int stride = this->stride;
+	const int bpp = this->bpp;
+	const int pad = PNG_ROW_PAD;
+	int y0 = band * 32;
+	int y1 = Min(y0 + 32, this->y);
+	u8* buf = calloc((stride + pad * 2) * 7);
+	u8* prev = buf + pad;
+	u8* cur = prev + stride + pad * 2;
+	u8* out[5];
+	
+	osAssert(buf != NULL);
+	for (int f = 0; f < 5; f++)
+		out[f] = cur + (stride + pad * 2) * (f + 1);
+	
+	if (y0 > 0)
+		memcpy(prev, &this->data[(y0 - 1) * stride], stride);
+	
+	for (int y = y0; y < y1; y++) {
+		u8* dst = &this->filt[y * (stride + 1)];
+		u32 cost[5] = {};
+		int best = 0;
+		
+		memcpy(cur, &this->data[y * stride], stride);
+		
+		for (int i = 0; i < stride; i += 16) {
+			u8x16 x = *(u8x16*)&cur[i];
+			u8x16 a = *(u8x16*)&cur[i - bpp];
+			u8x16 b = *(u8x16*)&prev[i];
+			u8x16 c = *(u8x16*)&prev[i - bpp];
+			u8x16 avg = (a >> 1) + (b >> 1) + (a & b & 1);
+			u8x16 mask = {};
+			u8x16 r[5] = {
+				x,
+				x - a,
+				x - b,
+				x - avg,
+				x - Png_Paeth(a, b, c),
+			};
+			
+			for (int k = 0; k < 16; k++)
+				mask[k] = i + k < stride ? 0xFF : 0;
+			
+			for (int f = 0; f < 5; f++) {
+				*(u8x16*)&out[f][i] = r[f];
+				cost[f] += Png_Cost(r[f], mask);
+			}
+		}
+		
+		for (int f = 1; f < 5; f++)
+			if (cost[f] < cost[best])
+				best = f;
+		
+		dst[0] = best;
+		memcpy(dst + 1, out[best], stride);
+		Swap(cur, prev);
+	}
+	
+	free(buf);
+}
+
+static mz_bool Png_DeflateOut(const void* buf, int len, void* user) {
+	return Memfile_Write(user, buf, len) == len;
+}
+
+/**
+ * Deflates one block of the filtered image. The compressor is first fed
+ * the tail of the previous block and sync flushed, that output is dropped
+ * so the block can still refer back into the previous data.
+ */
+static void Png_DeflateBlock(PngDeflateCtx* this, u32 index) {
+	tdefl_compressor* d = tdefl_compressor_alloc();
+	size_t start = (size_t)index * PNG_BLOCK_SIZE;
+	size_t size = Min(this->size - start, PNG_BLOCK_SIZE);
+	Memfile* mem = &this->block[index].mem;
+	
+	osAssert(d != NULL);
+	Memfile_Alloc(mem, size / 2 + 1024);
+	tdefl_init(d, Png_DeflateOut, mem, this->flags);
+	
+	if (index) {
+		size_t dict = Min(start, PNG_DICT_SIZE);
+		
+		tdefl_compress_buffer(d, this->filt + start - dict, dict, TDEFL_SYNC_FLUSH);
+		this->block[index].skip = mem->size;
+	}
+	
+	tdefl_compress_buffer(d, this->filt + start, size, index + 1 == this->num ? TDEFL_FINISH : TDEFL_SYNC_FLUSH);
+	this->block[index].adler = mz_adler32(MZ_ADLER32_INIT, this->filt + start, size);
+	this->block[index].adlerLen = size;
+	
+	tdefl_compressor_free(d);
+}
+
+static u32 Png_Adler32Combine(u32 adler1, u32 adler2, size_t len2) {
+	const u32 base = 65521;
+	u32 rem = len2 % base;
+	u32 sum1 = adler1 & 0xFFFF;
+	u32 sum2 = (rem * sum1) % base;
+	
+	sum1 += (adler2 & 0xFFFF) + base - 1;
+	sum2 += (adler1 >> 16) + (adler2 >> 16) + base - rem;
+	
+	if (sum1 >= base) sum1 -= base;
+	if (sum1 >= base) sum1 -= base;
+	if (sum2 >= (base << 1)) sum2 -= (base << 1);
+	if (sum2 >= base) sum2 -= base;
+	
+	return sum1 | (sum2 << 16);
+}
+
+static void Png_Chunk(Memfile* out, const char* type, const void* a, u32 alen, const void* b, u32 blen) {
+	u8 head[8];
+	u32 crc;
+	
+	Png_U32(head, alen + blen);
+	memcpy(head + 4, type, 4);
+	Memfile_Write(out, head, 8);
+	
+	crc = mz_crc32(MZ_CRC32_INIT, head + 4, 4);
+	if (alen) {
+		Memfile_Write(out, a, alen);
+		crc = mz_crc32(crc, a, alen);
+	}
+	if (blen) {
+		Memfile_Write(out, b, blen);
+		crc = mz_crc32(crc, b, blen);
+	}
+	
+	Png_U32(head, crc);
+	Memfile_Write(out, head, 4);
+}
+
+/**
+ * Filtering and deflate both run in parallel. Every deflate block ends on
+ * a byte boundary, so the blocks are written back to back as separate
+ * IDAT chunks forming a single zlib stream.
+ */
+static void Png_Save(Image* this, const char* file, int level) {
+	const int chn = this->channels ? this->channels : 4;
+	const u8 colorType[] = { 0, 0, 4, 2, 6 };
+	PngFilterCtx filter = {
+		.data   = this->data,
+		.y      = this->y,
+		.stride = this->x * chn,
+		.bpp    = chn,
+	};
+	PngDeflateCtx deflate = {};
+	Memfile out = Memfile_New();
+	u8 ihdr[13] = {};
+	u8 zhead[2] = { 0x78, 0xDA };
+	u8 ztail[4];
+	u32 adler = MZ_ADLER32_INIT;
+	
+	osAssert(chn >= 1 && chn <= 4);
+	
+	deflate.size = (size_t)(filter.stride + 1) * this->y;
+	deflate.num = (deflate.size + PNG_BLOCK_SIZE - 1) / PNG_BLOCK_SIZE;
+	deflate.flags = tdefl_create_comp_flags_from_zip_params(level, -MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY);
+	deflate.filt = filter.filt = malloc(deflate.size);
+	deflate.block = calloc(sizeof(*deflate.block) * deflate.num);
+	osAssert(filter.filt != NULL && deflate.block != NULL);
+	
+	Parallel_For((this->y + 31) / 32, 0, Png_FilterRows, &filter);
+	Parallel_For(deflate.num, 0, Png_DeflateBlock, &deflate);
+	
+	Png_U32(ihdr, this->x);
+	Png_U32(ihdr + 4, this->y);
+	ihdr[8] = 8;
+	ihdr[9] = colorType[chn];
+	
+	Memfile_Alloc(&out, deflate.size / 2 + 1024);
+	Memfile_Write(&out, "\x89PNG\r\n\x1A\n", 8);
+	Png_Chunk(&out, "IHDR", ihdr, 13, NULL, 0);
+	
+	for (u32 i = 0; i < deflate.num; i++) {
+		Memfile* mem = &deflate.block[i].mem;
+		
+		adler = i ? Png_Adler32Combine(adler, deflate.block[i].adler, deflate.block[i].adlerLen) : deflate.block[i].adler;
+		
+		Png_Chunk(&out, "IDAT",
+			i ? NULL : zhead, i ? 0 : 2,
+			&mem->cast.u8[deflate.block[i].skip], mem->size - deflate.block[i].skip);
+		Memfile_Free(mem);
+	}
+	
+	Png_U32(ztail, adler);
+	Png_Chunk(&out, "IDAT", ztail, 4, NULL, 0);
+	Png_Chunk(&out, "IEND", NULL, 0, NULL, 0);
+	
+	Memfile_SaveBin(&out, file);
+	Memfile_Free(&out);
+	free(deflate.block);
+	free(filter.filt);
+}
+
 void Image_Save(Image* this, const char* file) {
 	osLog("Image_Save: %s", file);
 	if (!Image_Validate(this))
 		errr("uninitialized texel save to [%s]", file);
 	if (!striend(file, ".png"))
 		errr("can't save image to [%s] format", x_filename(file) + strlen(x_basename(file)));
-	stbi_write_png_compression_level = !this->compress ? 8 : this->compress;
-	stbi_write_png(file, this->x, this->y, 4, this->data, 0);
+	Png_Save(this, file, !this->compress ? 4 : this->compress);
 }
 
 void Image_LoadMem(Image* this, const void* data, size_t size) {
@@ -71,6 +422,8 @@ void Image_LoadMem(Image* this, const void* data, size_t size) {
 	
 	this->data = stbi_load_from_memory(data, size, &this->x, &this->y, &this->channels, 4);
 	if (!this->data && this->throwError) errr("Failed to load texel from memory");
+	this->channels = 4;
+	this->memSize = this->size = this->x * this->y * this->channels;
 	this->type = 'm';
 }
 
@@ -86,7 +439,7 @@ void Image_CropFrom(Image* dst, Image* src, Rect crop) {
 	Image_Free(dst);
 	
 	int chnl = dst->channels = src->channels;
-	dst->size = crop.w * crop.h * src->channels;
+	dst->memSize = dst->size = crop.w * crop.h * src->channels;
 	dst->data = new(u8[dst->size]);
 	
 	for (int y = 0; y < crop.h; y++)
@@ -96,9 +449,20 @@ void Image_CropFrom(Image* dst, Image* src, Rect crop) {
 			src->x * chnl);
 }
 
+// Memory of Image_FromRaw stays with the caller, the next allocation is fresh
+static void Image_Detach(Image* this) {
+	if (this->type != 'r')
+		return;
+	
+	this->data = NULL;
+	this->memSize = 0;
+	this->type = 'n';
+}
+
 void Image_Alloc(Image* this, int x, int y, int channels) {
 	this->data = realloc(this->data, x * y * channels * 2);
 	this->size = x * y * channels;
+	this->memSize = this->size * 2;
 	this->x = x; this->y = y;
 }
 
@@ -109,42 +473,724 @@ void Image_Free(Image* this) {
 	*this = Image_New();
 }
 
-void Image_Downscale(Image* this, int newx, int newy) {
-	if (this->x == newx && this->y == newy)
-		return;
+/*============================================================================*/
+
+typedef f32 f32x4 __attribute__((vector_size(16), aligned(4)));
+
+#define RESAMPLE_BAND 16
+
+typedef struct {
+	s32* start;
+	s32* num;
+	f32* weight;
+	s32  taps;
+} ResampleKernel;
+
+typedef struct {
+	Image* src;
+	u8*    dst;
+	int    newx;
+	int    newy;
+	int    channels;
+	ResampleKernel kx;
+	ResampleKernel ky;
+} ResampleCtx;
+
+static f32 Resample_Sinc(f32 x) {
+	x *= M_PI;
+	
+	return fabsf(x) < 1e-5f ? 1.0f : sinf(x) / x;
+}
+
+static f32 Resample_Filter(ImageFilter filter, f32 x) {
+	x = fabsf(x);
 	
-	u8* new = new(u8[newy][newx][this->channels]);
-	float x_ratio = (this->x - 1) / (float)(newx - 1);
-	float y_ratio = (this->y - 1) / (float)(newy - 1);
-	u8* pixels = this->data;
-	u8* dest = new;
-	
-	for (int i = 0; i < newy; i++) {
-		for (int j = 0; j < newx; j++) {
-			int x = (int)(x_ratio * j);
-			int y = (int)(y_ratio * i);
-			f32 x_diff = (x_ratio * j) - x;
-			f32 y_diff = (y_ratio * i) - y;
-			int index = (y * this->x + x) * this->channels;
+	switch (filter) {
+		case IMAGE_FILTER_BOX:
+			return x <= 0.5f ? 1.0f : 0.0f;
 			
-			f32 aMod = (1.0f - x_diff) * (1.0f - y_diff);
-			f32 bMod = x_diff * (1.0f - y_diff);
-			f32 cMod = y_diff * (1.0f - x_diff);
-			f32 dMod = x_diff * y_diff;
+		case IMAGE_FILTER_TRIANGLE:
+			return x < 1.0f ? 1.0f - x : 0.0f;
 			
-			for (int chnl = 0; chnl < this->channels; chnl++) {
-				u8 a = pixels[chnl + index];
-				u8 b = pixels[chnl + index + this->channels];
-				u8 c = pixels[chnl + index + this->x * this->channels];
-				u8 d = pixels[chnl + index + this->x * this->channels + this->channels];
-				
-				*dest++ = a * aMod + b * bMod + c * cMod + d * dMod;
-			}
+		case IMAGE_FILTER_MITCHELL: {
+			const f32 B = 1.0f / 3.0f;
+			const f32 C = 1.0f / 3.0f;
+			
+			if (x < 1.0f)
+				return ((12 - 9 * B - 6 * C) * x * x * x + (-18 + 12 * B + 6 * C) * x * x + (6 - 2 * B)) / 6.0f;
+			if (x < 2.0f)
+				return ((-B - 6 * C) * x * x * x + (6 * B + 30 * C) * x * x + (-12 * B - 48 * C) * x + (8 * B + 24 * C)) / 6.0f;
+			
+			return 0.0f;
+		}
+		
+		case IMAGE_FILTER_LANCZOS:
+			return x < 3.0f ? Resample_Sinc(x) * Resample_Sinc(x / 3.0f) : 0.0f;
+	}
+	
+	return 0.0f;
+}
+
+static f32 Resample_Support(ImageFilter filter) {
+	static const f32 support[] = {
+		[IMAGE_FILTER_BOX] = 0.5f,
+		[IMAGE_FILTER_TRIANGLE] = 1.0f,
+		[IMAGE_FILTER_MITCHELL] = 2.0f,
+		[IMAGE_FILTER_LANCZOS] = 3.0f,
+	};
+	
+	return support[filter];
+}
+
+/**
+ * Weights of every source pixel contributing to each destination pixel.
+ * When shrinking the filter is widened by the ratio so it covers all
+ * source pixels, out of range taps are folded onto the edge pixel.
+ */
+static void Resample_Kernel(ResampleKernel* this, int srcn, int dstn, ImageFilter filter) {
+	f32 scale = (f32)srcn / dstn;
+	f32 fscale = Max(scale, 1.0f);
+	f32 support = Resample_Support(filter) * fscale;
+	
+	this->taps = (s32)ceilf(support * 2.0f) + 1;
+	this->start = malloc(sizeof(s32) * dstn * 2);
+	this->num = this->start + dstn;
+	this->weight = calloc(sizeof(f32) * dstn * this->taps);
+	
+	for (int i = 0; i < dstn; i++) {
+		f32 center = (i + 0.5f) * scale - 0.5f;
+		s32 j0 = (s32)floorf(center - support);
+		s32 j1 = (s32)ceilf(center + support);
+		s32 lo = clamp(j0, 0, srcn - 1);
+		s32 hi = clamp(j1, 0, srcn - 1);
+		f32* w = &this->weight[i * this->taps];
+		f32 sum = 0.0f;
+		
+		hi = Min(hi, lo + this->taps - 1);
+		this->start[i] = lo;
+		this->num[i] = hi - lo + 1;
+		
+		for (s32 j = j0; j <= j1; j++) {
+			f32 v = Resample_Filter(filter, (j - center) / fscale);
+			s32 k = clamp(j, lo, hi) - lo;
+			
+			w[k] += v;
+			sum += v;
+		}
+		
+		if (sum != 0.0f)
+			for (int k = 0; k < this->num[i]; k++)
+				w[k] /= sum;
+		else
+			w[clamp((s32)roundf(center), lo, hi) - lo] = 1.0f;
+	}
+}
+
+static void Resample_KernelFree(ResampleKernel* this) {
+	free(this->start);
+	free(this->weight);
+}
+
+static inline f32x4 Resample_LoadPixel(const u8* p, int channels) {
+	switch (channels) {
+		case 4:
+			return (f32x4) { p[0], p[1], p[2], p[3] };
+		case 3:
+			return (f32x4) { p[0], p[1], p[2], 0 };
+		case 2:
+			return (f32x4) { p[0], p[1], 0, 0 };
+		default:
+			return (f32x4) { p[0], 0, 0, 0 };
+	}
+}
+
+static inline void Resample_StorePixel(u8* p, f32x4 v, int channels) {
+	v += 0.5f;
+	
+	for (int c = 0; c < channels; c++)
+		p[c] = clamp(v[c], 0.0f, 255.0f);
+}
+
+// Filters one band of destination rows, horizontal pass into a local buffer first
+static void Resample_Band(ResampleCtx* this, u32 band) {
+	int y0 = band * RESAMPLE_BAND;
+	int y1 = Min(y0 + RESAMPLE_BAND, this->newy);
+	int sy0 = this->ky.start[y0];
+	int sy1 = sy0;
+	int chn = this->channels;
+	int srcx = this->src->x;
+	f32x4* row;
+	
+	for (int y = y0; y < y1; y++)
+		sy1 = Max(sy1, this->ky.start[y] + this->ky.num[y]);
+	
+	row = malloc(sizeof(f32x4) * this->newx * (sy1 - sy0));
+	osAssert(row != NULL);
+	
+	for (int sy = sy0; sy < sy1; sy++) {
+		const u8* src = &this->src->data[sy * srcx * chn];
+		f32x4* out = &row[(sy - sy0) * this->newx];
+		
+		for (int x = 0; x < this->newx; x++) {
+			const u8* p = &src[this->kx.start[x] * chn];
+			const f32* w = &this->kx.weight[x * this->kx.taps];
+			f32x4 acc = {};
+			
+			for (int k = 0; k < this->kx.num[x]; k++, p += chn)
+				acc += w[k] * Resample_LoadPixel(p, chn);
+			
+			out[x] = acc;
+		}
+	}
+	
+	for (int y = y0; y < y1; y++) {
+		const f32* w = &this->ky.weight[y * this->ky.taps];
+		f32x4* in = &row[(this->ky.start[y] - sy0) * this->newx];
+		u8* dst = &this->dst[y * this->newx * chn];
+		
+		for (int x = 0; x < this->newx; x++, dst += chn) {
+			f32x4 acc = {};
+			
+			for (int k = 0; k < this->ky.num[y]; k++)
+				acc += w[k] * in[k * this->newx + x];
+			
+			Resample_StorePixel(dst, acc, chn);
 		}
 	}
 	
+	free(row);
+}
+
+/**
+ * Resamples src into dst with a separable filter, bands of rows are
+ * processed in parallel. dst may not be src, see Image_Resize.
+ */
+void Image_Resample(Image* dst, Image* src, int newx, int newy, ImageFilter filter) {
+	ResampleCtx ctx = {
+		.src      = src,
+		.newx     = newx,
+		.newy     = newy,
+		.channels = src->channels,
+	};
+	
+	osAssert(dst != src);
+	osAssert(newx > 0 && newy > 0);
+	osAssert(src->channels >= 1 && src->channels <= 4);
+	
+	Image_Validate(dst);
+	Image_Detach(dst);
+	Image_Alloc(dst, newx, newy, src->channels);
+	dst->channels = src->channels;
+	ctx.dst = dst->data;
+	
+	Resample_Kernel(&ctx.kx, src->x, newx, filter);
+	Resample_Kernel(&ctx.ky, src->y, newy, filter);
+	
+	Parallel_For((newy + RESAMPLE_BAND - 1) / RESAMPLE_BAND, 0, Resample_Band, &ctx);
+	
+	Resample_KernelFree(&ctx.kx);
+	Resample_KernelFree(&ctx.ky);
+}
+
+void Image_Resize(Image* this, int newx, int newy, ImageFilter filter) {
+	Image tmp = Image_New();
+	
+	if (this->x == newx && this->y == newy)
+		return;
+	
+	Image_Resample(&tmp, this, newx, newy, filter);
+	
 	delete(this->data);
-	this->data = new;
+	this->data = tmp.data;
+	this->size = tmp.size;
+	this->memSize = tmp.memSize;
 	this->x = newx;
 	this->y = newy;
 }
+
+void Image_Downscale(Image* this, int newx, int newy) {
+	Image_Resize(this, newx, newy, IMAGE_FILTER_TRIANGLE);
+}
+
+/**
+ * Fills mip with up to num levels, each half the size of the previous
+ * one down to 1x1. Returns the number of generated levels.
+ */
+int Image_GenMips(Image* this, Image* mip, int num, ImageFilter filter) {
+	Image* prev = this;
+	int i;
+	
+	for (i = 0; i < num; i++) {
+		int x = Max(prev->x / 2, 1);
+		int y = Max(prev->y / 2, 1);
+		
+		if (prev->x == 1 && prev->y == 1)
+			break;
+		
+		Image_Resample(&mip[i], prev, x, y, filter);
+		prev = &mip[i];
+	}
+	
+	return i;
+}
+
+/*============================================================================*/
+
+typedef f32 f32x16 __attribute__((vector_size(64), aligned(4)));
+typedef s32 s32x16 __attribute__((vector_size(64), aligned(4)));
+typedef u16 u16x8 __attribute__((vector_size(16), aligned(2)));
+typedef u8 u8x8 __attribute__((vector_size(8), aligned(1)));
+
+#define CONV_BLOCK (64 * 1024)
+
+typedef void (*ConvFunc)(void* dst, const u8* src, u32 num, int chn);
+
+typedef struct {
+	ConvFunc  func;
+	void*     dst;
+	const u8* src;
+	u32 num;
+	int inChn;
+	int outSize;
+} ConvCtx;
+
+static f32 sSrgbToLinear[256];
+static u8 sSrgbToLinear8[256];
+static u8 sLinearToSrgb[4096];
+
+onlaunch_func_t Image_ConvInit() {
+	for (int i = 0; i < 256; i++) {
+		f32 c = i / 255.0f;
+		
+		sSrgbToLinear[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+		sSrgbToLinear8[i] = sSrgbToLinear[i] * 255.0f + 0.5f;
+	}
+	
+	for (int i = 0; i < 4096; i++) {
+		f32 c = i / 4095.0f;
+		
+		c = c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+		sLinearToSrgb[i] = c * 255.0f + 0.5f;
+	}
+}
+
+static inline u8 Conv_LinearToSrgbF(f32 v) {
+	return sLinearToSrgb[(int)(clamp(v, 0.0f, 1.0f) * 4095.0f + 0.5f)];
+}
+
+static void Conv_Swizzle(void* dst, const u8* src, u32 num, int chn) {
+	const u8x16 idx4 = { 2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15 };
+	const u8x16 idx3 = { 2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, 15 };
+	u8* out = dst;
+	u32 n = num * chn;
+	u32 i = 0;
+	
+	for (; i + 16 <= n && chn == 4; i += 16)
+		*(u8x16*)&out[i] = __builtin_shuffle(*(u8x16*)&src[i], idx4);
+	for (; i + 16 <= n && chn == 3; i += 15)
+		*(u8x16*)&out[i] = __builtin_shuffle(*(u8x16*)&src[i], idx3);
+	
+	for (; i < n; i += chn) {
+		u8 r = src[i];
+		
+		out[i] = src[i + 2];
+		out[i + 1] = src[i + 1];
+		out[i + 2] = r;
+		if (chn == 4)
+			out[i + 3] = src[i + 3];
+	}
+}
+
+static void Conv_Premultiply(void* dst, const u8* src, u32 num, int chn) {
+	const u8x16 idxA = { 3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15 };
+	const u16x16 keepA = { 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255 };
+	u8* out = dst;
+	u32 i = 0;
+	
+	for (; i + 4 <= num; i += 4) {
+		u8x16 v = *(u8x16*)&src[i * 4];
+		u16x16 a = __builtin_convertvector(__builtin_shuffle(v, idxA), u16x16);
+		u16x16 t = __builtin_convertvector(v, u16x16) * (a | keepA) + 128;
+		
+		// (x * a + 127) / 255 without a division
+		*(u8x16*)&out[i * 4] = __builtin_convertvector((t + (t >> 8)) >> 8, u8x16);
+	}
+	
+	for (; i < num; i++) {
+		const u8* s = &src[i * 4];
+		u8* d = &out[i * 4];
+		u8 a = s[3];
+		
+		for (int c = 0; c < 3; c++)
+			d[c] = (s[c] * a + 127) / 255;
+		d[3] = a;
+	}
+}
+
+static void Conv_Unpremultiply(void* dst, const u8* src, u32 num, int chn) {
+	const u8x16 idxA = { 3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15 };
+	const s32x16 isA = { 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1 };
+	u8* out = dst;
+	u32 i = 0;
+	
+	for (; i + 4 <= num; i += 4) {
+		u8x16 v = *(u8x16*)&src[i * 4];
+		f32x16 a = __builtin_convertvector(__builtin_shuffle(v, idxA), f32x16);
+		f32x16 x = __builtin_convertvector(v, f32x16);
+		s32x16 zero = a == 0;
+		s32x16 over;
+		f32x16 r;
+		
+		a = (f32x16)(((s32x16)a & ~zero) | ((s32x16)((f32x16){} + 1.0f) & zero));
+		r = x * 255.0f / a + 0.5f;
+		over = r > 255.0f;
+		r = (f32x16)(((s32x16)r & ~over) | ((s32x16)((f32x16){} + 255.0f) & over));
+		r = (f32x16)(((s32x16)x & isA) | ((s32x16)r & ~(isA | zero)));
+		*(u8x16*)&out[i * 4] = __builtin_convertvector(r, u8x16);
+	}
+	
+	for (; i < num; i++) {
+		const u8* s = &src[i * 4];
+		u8* d = &out[i * 4];
+		u8 a = s[3];
+		
+		for (int c = 0; c < 3; c++)
+			d[c] = a ? Min(s[c] * 255 + a / 2, 255 * a) / a : 0;
+		d[3] = a;
+	}
+}
+
+static void Conv_ToRGB(void* dst, const u8* src, u32 num, int chn) {
+	const u8x16 idx = { 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 0, 0, 0, 0 };
+	u8* out = dst;
+	u32 i = 0;
+	
+	for (; i + 4 <= num; i += 4) {
+		u8x16 v = __builtin_shuffle(*(u8x16*)&src[i * 4], idx);
+		
+		memcpy(&out[i * 3], &v, 12);
+	}
+	
+	for (; i < num; i++)
+		memcpy(&out[i * 3], &src[i * 4], 3);
+}
+
+static void Conv_ToRGBA(void* dst, const u8* src, u32 num, int chn) {
+	const u8x16 idx3 = { 0, 1, 2, 16, 3, 4, 5, 16, 6, 7, 8, 16, 9, 10, 11, 16 };
+	const u8x16 idx1 = { 0, 0, 0, 16, 1, 1, 1, 16, 2, 2, 2, 16, 3, 3, 3, 16 };
+	const u8x16 opaque = (u8x16){} + 255;
+	u8* out = dst;
+	u32 i = 0;
+	
+	for (; i + 6 <= num && chn == 3; i += 4)
+		*(u8x16*)&out[i * 4] = __builtin_shuffle(*(u8x16*)&src[i * 3], opaque, idx3);
+	for (; i + 16 <= num && chn == 1; i += 4)
+		*(u8x16*)&out[i * 4] = __builtin_shuffle(*(u8x16*)&src[i], opaque, idx1);
+	
+	for (; i < num; i++) {
+		const u8* s = &src[i * chn];
+		u8* d = &out[i * 4];
+		
+		d[0] = s[0];
+		d[1] = chn >= 3 ? s[1] : s[0];
+		d[2] = chn >= 3 ? s[2] : s[0];
+		d[3] = chn == 4 ? s[3] : chn == 2 ? s[1] : 255;
+	}
+}
+
+// Rec.601 luma in 8.8 fixed point, alpha is dropped
+static void Conv_ToGray(void* dst, const u8* src, u32 num, int chn) {
+	const u16x16 w = { 77, 150, 29, 0, 77, 150, 29, 0, 77, 150, 29, 0, 77, 150, 29, 0 };
+	const u16x16 i1 = { 1, 2, 3, 0, 5, 6, 7, 0, 9, 10, 11, 0, 13, 14, 15, 0 };
+	const u16x16 i2 = { 2, 3, 0, 0, 6, 7, 0, 0, 10, 11, 0, 0, 14, 15, 0, 0 };
+	u8* out = dst;
+	u32 i = 0;
+	
+	for (; i + 4 <= num && chn == 4; i += 4) {
+		u16x16 v = __builtin_convertvector(*(u8x16*)&src[i * 4], u16x16) * w;
+		
+		v = (v + __builtin_shuffle(v, i1) + __builtin_shuffle(v, i2) + 128) >> 8;
+		for (int k = 0; k < 4; k++)
+			out[i + k] = v[k * 4];
+	}
+	
+	for (; i < num; i++) {
+		const u8* s = &src[i * chn];
+		
+		out[i] = (s[0] * 77 + s[1] * 150 + s[2] * 29 + 128) >> 8;
+	}
+}
+
+static void Conv_SrgbToLinear(void* dst, const u8* src, u32 num, int chn) {
+	u8* out = dst;
+	int color = chn == 2 || chn == 4 ? chn - 1 : chn;
+	
+	for (u32 i = 0; i < num; i++, src += chn, out += chn) {
+		for (int c = 0; c < color; c++)
+			out[c] = sSrgbToLinear8[src[c]];
+		if (color != chn)
+			out[color] = src[color];
+	}
+}
+
+static void Conv_LinearToSrgb(void* dst, const u8* src, u32 num, int chn) {
+	u8* out = dst;
+	int color = chn == 2 || chn == 4 ? chn - 1 : chn;
+	
+	for (u32 i = 0; i < num; i++, src += chn, out += chn) {
+		for (int c = 0; c < color; c++)
+			out[c] = sLinearToSrgb[src[c] * 4095 / 255];
+		if (color != chn)
+			out[color] = src[color];
+	}
+}
+
+static void Conv_ToFloat(void* dst, const u8* src, u32 num, int chn) {
+	f32* out = dst;
+	u32 n = num * chn;
+	u32 i = 0;
+	
+	for (; i + 16 <= n; i += 16)
+		*(f32x16*)&out[i] = __builtin_convertvector(*(u8x16*)&src[i], f32x16) * (1.0f / 255.0f);
+	for (; i < n; i++)
+		out[i] = src[i] * (1.0f / 255.0f);
+}
+
+static void Conv_ToFloatLinear(void* dst, const u8* src, u32 num, int chn) {
+	f32* out = dst;
+	int color = chn == 2 || chn == 4 ? chn - 1 : chn;
+	
+	for (u32 i = 0; i < num; i++, src += chn, out += chn) {
+		for (int c = 0; c < color; c++)
+			out[c] = sSrgbToLinear[src[c]];
+		if (color != chn)
+			out[color] = src[color] * (1.0f / 255.0f);
+	}
+}
+
+// 8 pixels of RGB(A) split into planes, alpha is 255 for RGB
+static inline void Conv_Planar8(const u8* src, int chn, u16x8* r, u16x8* g, u16x8* b, u16x8* a) {
+	u8 p[4][8];
+	
+	for (int i = 0; i < 8; i++, src += chn) {
+		p[0][i] = src[0];
+		p[1][i] = src[1];
+		p[2][i] = src[2];
+		p[3][i] = chn == 4 ? src[3] : 255;
+	}
+	
+	*r = __builtin_convertvector(*(u8x8*)p[0], u16x8);
+	*g = __builtin_convertvector(*(u8x8*)p[1], u16x8);
+	*b = __builtin_convertvector(*(u8x8*)p[2], u16x8);
+	*a = __builtin_convertvector(*(u8x8*)p[3], u16x8);
+}
+
+static void Conv_To5551(void* dst, const u8* src, u32 num, int chn) {
+	u16* out = dst;
+	u32 i = 0;
+	
+	for (; i + 8 <= num; i += 8) {
+		u16x8 r, g, b, a;
+		u16x8 v;
+		
+		Conv_Planar8(&src[i * chn], chn, &r, &g, &b, &a);
+		v = ((r >> 3) << 11) | ((g >> 3) << 6) | ((b >> 3) << 1) | (a >> 7);
+		memcpy(&out[i], &v, sizeof(v));
+	}
+	
+	for (; i < num; i++) {
+		const u8* s = &src[i * chn];
+		
+		out[i] = ((s[0] >> 3) << 11) | ((s[1] >> 3) << 6) | ((s[2] >> 3) << 1) | (chn == 4 ? s[3] >> 7 : 1);
+	}
+}
+
+static void Conv_To565(void* dst, const u8* src, u32 num, int chn) {
+	u16* out = dst;
+	u32 i = 0;
+	
+	for (; i + 8 <= num; i += 8) {
+		u16x8 r, g, b, a;
+		u16x8 v;
+		
+		Conv_Planar8(&src[i * chn], chn, &r, &g, &b, &a);
+		v = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+		memcpy(&out[i], &v, sizeof(v));
+	}
+	
+	for (; i < num; i++) {
+		const u8* s = &src[i * chn];
+		
+		out[i] = ((s[0] >> 3) << 11) | ((s[1] >> 2) << 5) | (s[2] >> 3);
+	}
+}
+
+static void Conv_Thd(ConvCtx* this, u32 block) {
+	u32 start = block * CONV_BLOCK;
+	u32 num = Min(this->num - start, CONV_BLOCK);
+	
+	this->func((u8*)this->dst + (size_t)start * this->outSize, this->src + (size_t)start * this->inChn, num, this->inChn);
+}
+
+/**
+ * Runs func over blocks of pixels. Conversions that shrink the data in
+ * place are run in order on the calling thread, a later block would
+ * otherwise overwrite source pixels of an earlier one.
+ */
+static void Conv_Run(ConvFunc func, void* dst, const u8* src, u32 num, int inChn, int outSize) {
+	ConvCtx ctx = {
+		.func    = func,
+		.dst     = dst,
+		.src     = src,
+		.num     = num,
+		.inChn   = inChn,
+		.outSize = outSize,
+	};
+	bool serial = dst == src && outSize < inChn;
+	
+	Parallel_For((num + CONV_BLOCK - 1) / CONV_BLOCK, serial ? 1 : 0, Conv_Thd, &ctx);
+}
+
+static void Image_Convert(Image* dst, Image* src, ConvFunc func, int outChn) {
+	u32 num = src->x * src->y;
+	
+	if (dst != src) {
+		Image_Validate(dst);
+		Image_Detach(dst);
+		if (!dst->data || dst->memSize < num * outChn) {
+			delete(dst->data);
+			dst->data = new(u8[num * outChn]);
+			dst->memSize = num * outChn;
+		}
+		dst->x = src->x;
+		dst->y = src->y;
+		
+		Conv_Run(func, dst->data, src->data, num, src->channels, outChn);
+	} else {
+		// In place growth, use a scratch buffer
+		if (outChn > src->channels) {
+			u8* data = new(u8[num * outChn]);
+			
+			Conv_Run(func, data, src->data, num, src->channels, outChn);
+			Image_Detach(src);
+			delete(src->data);
+			src->data = data;
+			src->memSize = num * outChn;
+		} else
+			Conv_Run(func, src->data, src->data, num, src->channels, outChn);
+	}
+	
+	dst->channels = outChn;
+	dst->size = num * outChn;
+}
+
+// RGBA <-> BGRA, RGB <-> BGR
+void Image_SwizzleBGRA(Image* dst, Image* src) {
+	osAssert(src->channels == 3 || src->channels == 4);
+	Image_Convert(dst, src, Conv_Swizzle, src->channels);
+}
+
+void Image_Premultiply(Image* dst, Image* src) {
+	osAssert(src->channels == 4);
+	Image_Convert(dst, src, Conv_Premultiply, 4);
+}
+
+void Image_Unpremultiply(Image* dst, Image* src) {
+	osAssert(src->channels == 4);
+	Image_Convert(dst, src, Conv_Unpremultiply, 4);
+}
+
+void Image_ToRGB(Image* dst, Image* src) {
+	osAssert(src->channels == 4);
+	Image_Convert(dst, src, Conv_ToRGB, 3);
+}
+
+void Image_ToRGBA(Image* dst, Image* src) {
+	osAssert(src->channels >= 1 && src->channels <= 4);
+	Image_Convert(dst, src, Conv_ToRGBA, 4);
+}
+
+void Image_ToGray(Image* dst, Image* src) {
+	osAssert(src->channels == 3 || src->channels == 4);
+	Image_Convert(dst, src, Conv_ToGray, 1);
+}
+
+// Color channels only, alpha is kept as is
+void Image_SrgbToLinear(Image* dst, Image* src) {
+	Image_Convert(dst, src, Conv_SrgbToLinear, src->channels);
+}
+
+void Image_LinearToSrgb(Image* dst, Image* src) {
+	Image_Convert(dst, src, Conv_LinearToSrgb, src->channels);
+}
+
+/**
+ * dst holds x * y * channels floats in the 0..1 range. With linear the
+ * color channels are decoded from sRGB.
+ */
+void Image_ToFloat(Image* this, f32* dst, bool linear) {
+	Conv_Run(linear ? Conv_ToFloatLinear : Conv_ToFloat, dst, this->data, this->x * this->y, this->channels, this->channels * sizeof(f32));
+}
+
+void Image_FromFloat(Image* this, const f32* src, int x, int y, int channels, bool linear) {
+	int color = channels == 2 || channels == 4 ? channels - 1 : channels;
+	u32 n = x * y * channels;
+	
+	Image_Validate(this);
+	Image_Detach(this);
+	Image_Alloc(this, x, y, channels);
+	this->channels = channels;
+	
+	for (u32 i = 0; i < n; i++) {
+		f32 v = src[i];
+		
+		if (linear && i % channels < color)
+			this->data[i] = Conv_LinearToSrgbF(v);
+		else
+			this->data[i] = clamp(v, 0.0f, 1.0f) * 255.0f + 0.5f;
+	}
+}
+
+// dst holds x * y u16, RGB sources get an opaque alpha bit
+void Image_ToRGBA5551(Image* this, u16* dst) {
+	osAssert(this->channels == 3 || this->channels == 4);
+	Conv_Run(Conv_To5551, dst, this->data, this->x * this->y, this->channels, sizeof(u16));
+}
+
+void Image_ToRGB565(Image* this, u16* dst) {
+	osAssert(this->channels == 3 || this->channels == 4);
+	Conv_Run(Conv_To565, dst, this->data, this->x * this->y, this->channels, sizeof(u16));
+}
+
+void Image_FromRGBA5551(Image* this, const u16* src, int x, int y) {
+	Image_Validate(this);
+	Image_Detach(this);
+	Image_Alloc(this, x, y, 4);
+	this->channels = 4;
+	
+	for (int i = 0; i < x * y; i++) {
+		u16 v = src[i];
+		u8* d = &this->data[i * 4];
+		
+		d[0] = ((v >> 11) & 0x1F) * 255 / 31;
+		d[1] = ((v >> 6) & 0x1F) * 255 / 31;
+		d[2] = ((v >> 1) & 0x1F) * 255 / 31;
+		d[3] = v & 1 ? 255 : 0;
+	}
+}
+
+void Image_FromRGB565(Image* this, const u16* src, int x, int y) {
+	Image_Validate(this);
+	Image_Detach(this);
+	Image_Alloc(this, x, y, 3);
+	this->channels = 3;
+	
+	for (int i = 0; i < x * y; i++) {
+		u16 v = src[i];
+		u8* d = &this->data[i * 3];
+		
+		d[0] = ((v >> 11) & 0x1F) * 255 / 31;
+		d[1] = ((v >> 5) & 0x3F) * 255 / 63;
+		d[2] = (v & 0x1F) * 255 / 31;
+	}
+}
@@ -6,11 +6,331 @@
 #include "ext_zip.h"
 #include "impl/zip.h"
 
+#define MINIZ_HEADER_FILE_ONLY
+#define MINIZ_NO_ZLIB_COMPATIBLE_NAMES
+#include "impl/miniz.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/*============================================================================*/
+
+static inline u16 Zip_U16(const u8* p) {
+	return p[0] | p[1] << 8;
+}
+
+static inline u32 Zip_U32(const u8* p) {
+	return p[0] | p[1] << 8 | p[2] << 16 | (u32)p[3] << 24;
+}
+
+static inline u64 Zip_U64(const u8* p) {
+	return Zip_U32(p) | (u64)Zip_U32(p + 4) << 32;
+}
+
+static u32 Zip_Hash(const char* s) {
+	u32 h = 0x811C9DC5;
+	
+	while (*s)
+		h = (h ^ (u8)*s++) * 0x01000193;
+	
+	return h;
+}
+
+/**
+ * Copy on write mapping of the whole archive. Slices of it are handed
+ * out for stored entries, so writing into one never touches the file.
+ */
+static bool Zip_Map(Zip* zip, const char* file) {
+#ifdef _WIN32
+	HANDLE f = CreateFileW(x_stras16((char*)file), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	LARGE_INTEGER size;
+	HANDLE map;
+	
+	if (f == INVALID_HANDLE_VALUE)
+		return false;
+	
+	if (!GetFileSizeEx(f, &size) || !size.QuadPart || !(map = CreateFileMappingW(f, NULL, PAGE_WRITECOPY, 0, 0, NULL))) {
+		CloseHandle(f);
+		return false;
+	}
+	CloseHandle(f);
+	
+	if (!(zip->map.data = MapViewOfFile(map, FILE_MAP_COPY, 0, 0, 0))) {
+		CloseHandle(map);
+		return false;
+	}
+	
+	zip->map.size = size.QuadPart;
+	zip->map.handle = map;
+#else
+	int fd = open(file, O_RDONLY);
+	struct stat st;
+	void* data;
+	
+	if (fd < 0)
+		return false;
+	
+	if (fstat(fd, &st) || !st.st_size) {
+		close(fd);
+		return false;
+	}
+	
+	data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	
+	if (data == MAP_FAILED)
+		return false;
+	
+	zip->map.data = data;
+	zip->map.size = st.st_size;
+#endif
+	
+	return true;
+}
+
+static void Zip_Unmap(Zip* zip) {
+	if (!zip->map.data)
+		return;
+	
+#ifdef _WIN32
+	UnmapViewOfFile(zip->map.data);
+	CloseHandle(zip->map.handle);
+#else
+	munmap(zip->map.data, zip->map.size);
+#endif
+	zip->map.data = NULL;
+}
+
+static void Zip_FreeIndex(Zip* zip) {
+	delete(zip->index.entry, zip->index.hash, zip->index.sorted, zip->index.names);
+	zip->index.num = 0;
+}
+
+/**
+ * Parses the central directory straight out of the mapping. Builds a
+ * name hash for lookups and a name sorted order for prefix queries.
+ * Entry indices match the ones used by the zip library.
+ */
+static bool Zip_BuildIndex(Zip* zip) {
+	const u8* data = zip->map.data;
+	const u8* end = data + zip->map.size;
+	const u8* eocd = NULL;
+	const u8* stop;
+	const u8* cdEnd;
+	const u8* p;
+	u64 num, cdSize, cdOffset;
+	char* name;
+	
+	if (zip->map.size < 22)
+		return false;
+	
+	stop = zip->map.size > 22 + 0xFFFF ? end - 22 - 0xFFFF : data;
+	for (p = end - 22; p >= stop; p--) {
+		if (Zip_U32(p) == 0x06054B50) {
+			eocd = p;
+			break;
+		}
+	}
+	
+	if (!eocd)
+		return false;
+	
+	num = Zip_U16(eocd + 10);
+	cdSize = Zip_U32(eocd + 12);
+	cdOffset = Zip_U32(eocd + 16);
+	
+	if (num == 0xFFFF || cdSize == 0xFFFFFFFF || cdOffset == 0xFFFFFFFF) {
+		const u8* loc = eocd - 20;
+		const u8* eocd64;
+		
+		if (loc < data || Zip_U32(loc) != 0x07064B50)
+			return false;
+		
+		eocd64 = data + Zip_U64(loc + 8);
+		if (eocd64 < data || eocd64 + 56 > end || Zip_U32(eocd64) != 0x06064B50)
+			return false;
+		
+		num = Zip_U64(eocd64 + 32);
+		cdSize = Zip_U64(eocd64 + 40);
+		cdOffset = Zip_U64(eocd64 + 48);
+	}
+	
+	if (cdOffset + cdSize > zip->map.size)
+		return false;
+	
+	// Every record takes at least 46 bytes, which also bounds the names
+	if (num > cdSize / 46)
+		return false;
+	
+	zip->index.entry = calloc(sizeof(ZipEntry) * Max(num, 1));
+	zip->index.names = name = malloc(cdSize + 1);
+	zip->index.num = num;
+	
+	p = data + cdOffset;
+	cdEnd = p + cdSize;
+	for (u32 i = 0; i < num; i++) {
+		ZipEntry* e = &zip->index.entry[i];
+		u16 nameLen, extraLen, commentLen;
+		const u8* extra;
+		
+		if (p + 46 > cdEnd || Zip_U32(p) != 0x02014B50)
+			goto fail;
+		
+		nameLen = Zip_U16(p + 28);
+		extraLen = Zip_U16(p + 30);
+		commentLen = Zip_U16(p + 32);
+		if (p + 46 + nameLen + extraLen + commentLen > cdEnd)
+			goto fail;
+		
+		e->method = Zip_U16(p + 10);
+		e->crc32 = Zip_U32(p + 16);
+		e->compSize = Zip_U32(p + 20);
+		e->size = Zip_U32(p + 24);
+		e->offset = Zip_U32(p + 42);
+		
+		memcpy(name, p + 46, nameLen);
+		name[nameLen] = '\0';
+		e->name = name;
+		e->isDir = nameLen && name[nameLen - 1] == '/';
+		name += nameLen + 1;
+		
+		// Zip64 extra field, only the saturated values are present
+		extra = p + 46 + nameLen;
+		for (const u8* x = extra; x + 4 <= extra + extraLen; x += 4 + Zip_U16(x + 2)) {
+			const u8* f = x + 4;
+			const u8* fend = f + Zip_U16(x + 2);
+			
+			if (fend > extra + extraLen)
+				goto fail;
+			if (Zip_U16(x) != 0x0001)
+				continue;
+			
+			if (e->size == 0xFFFFFFFF) {
+				if (f + 8 > fend) goto fail;
+				e->size = Zip_U64(f), f += 8;
+			}
+			if (e->compSize == 0xFFFFFFFF) {
+				if (f + 8 > fend) goto fail;
+				e->compSize = Zip_U64(f), f += 8;
+			}
+			if (e->offset == 0xFFFFFFFF) {
+				if (f + 8 > fend) goto fail;
+				e->offset = Zip_U64(f);
+			}
+			break;
+		}
+		
+		p += 46 + nameLen + extraLen + commentLen;
+	}
+	
+	u32 hashNum = 16;
+	
+	while (hashNum < num * 2)
+		hashNum <<= 1;
+	
+	zip->index.hash = calloc(sizeof(u32) * hashNum);
+	zip->index.hashMask = hashNum - 1;
+	zip->index.sorted = malloc(sizeof(u32) * Max(num, 1));
+	
+	for (u32 i = 0; i < num; i++) {
+		u32 h = Zip_Hash(zip->index.entry[i].name) & zip->index.hashMask;
+		
+		// Keep the first of duplicate names, same as a linear search would
+		while (zip->index.hash[h])
+			h = (h + 1) & zip->index.hashMask;
+		zip->index.hash[h] = i + 1;
+		zip->index.sorted[i] = i;
+	}
+	
+	nested(int, cmp, (const void* a, const void* b)) {
+		int r = strcmp(zip->index.entry[*(u32*)a].name, zip->index.entry[*(u32*)b].name);
+		
+		return r ? r : (int)(*(u32*)a - *(u32*)b);
+	};
+	
+	qsort(zip->index.sorted, num, sizeof(u32), (void*)cmp);
+	
+	return true;
+	
+fail:
+	Zip_FreeIndex(zip);
+	
+	return false;
+}
+
+/**
+ * Stored entries become a borrowed slice of the mapping, deflated ones
+ * are inflated from it into a buffer of the exact size.
+ */
+static int Zip_ReadEntry(Zip* zip, u32 index, Memfile* mem) {
+	ZipEntry* e = &zip->index.entry[index];
+	const u8* end = zip->map.data + zip->map.size;
+	const u8* local = zip->map.data + e->offset;
+	const u8* data;
+	
+	if (e->isDir)
+		return 0;
+	
+	if (local + 30 > end || Zip_U32(local) != 0x04034B50)
+		return ZIP_ERROR_RW_ENTRY;
+	
+	data = local + 30 + Zip_U16(local + 26) + Zip_U16(local + 28);
+	if (data + e->compSize > end)
+		return ZIP_ERROR_RW_ENTRY;
+	
+	switch (e->method) {
+		case 0:
+			if (e->compSize != e->size || mz_crc32(MZ_CRC32_INIT, data, e->size) != e->crc32)
+				return ZIP_ERROR_RW_ENTRY;
+			
+			Memfile_LoadMem(mem, data, e->size);
+			mem->param.external = true;
+			break;
+			
+		case 8: {
+			u8* out = malloc(Max(e->size, 1));
+			
+			if (tinfl_decompress_mem_to_mem(out, e->size, data, e->compSize, 0) != e->size ||
+				mz_crc32(MZ_CRC32_INIT, out, e->size) != e->crc32) {
+				free(out);
+				
+				return ZIP_ERROR_RW_ENTRY;
+			}
+			
+			Memfile_LoadMem(mem, out, e->size);
+			break;
+		}
+		
+		default:
+			return ZIP_ERROR_RW_ENTRY;
+	}
+	
+	delete(mem->info.name);
+	mem->info.name = strdup(e->name);
+	
+	return 0;
+}
+
+/*============================================================================*/
+
 void* Zip_Load(Zip* zip, const char* file, char mode) {
-	zip->filename = strdup(file);
+	*zip = (Zip) { .filename = strdup(file) };
 	
 	switch (mode) {
 		case ZIP_READ:
+			// The zip library is only opened if the index can not be built
+			if (Zip_Map(zip, file)) {
+				if (Zip_BuildIndex(zip))
+					return zip->map.data;
+				Zip_Unmap(zip);
+			}
+			
 			return zip->pkg = zip_open(file, 0, mode);
 			
 		case ZIP_WRITE:
@@ -25,13 +345,43 @@ void* Zip_Load(Zip* zip, const char* file, char mode) {
 }
 
 int Zip_GetEntryNum(Zip* zip) {
+	if (zip->map.data)
+		return zip->index.num;
+	
 	return zip_entries_total(zip->pkg);
 }
 
+ZipEntry* Zip_Find(Zip* zip, const char* entry) {
+	u32 h;
+	
+	if (!zip->map.data)
+		return NULL;
+	
+	h = Zip_Hash(entry) & zip->index.hashMask;
+	
+	for (; zip->index.hash[h]; h = (h + 1) & zip->index.hashMask) {
+		ZipEntry* e = &zip->index.entry[zip->index.hash[h] - 1];
+		
+		if (streq(e->name, entry))
+			return e;
+	}
+	
+	return NULL;
+}
+
 int Zip_ReadByName(Zip* zip, const char* entry, Memfile* mem) {
 	void* data = NULL;
 	size_t sz;
 	
+	if (zip->map.data) {
+		ZipEntry* e = Zip_Find(zip, entry);
+		
+		if (!e)
+			return ZIP_ERROR_OPEN_ENTRY;
+		
+		return Zip_ReadEntry(zip, e - zip->index.entry, mem);
+	}
+	
 	if (zip_entry_open(zip->pkg, entry))
 		return ZIP_ERROR_OPEN_ENTRY;
 	if (zip_entry_read(zip->pkg, &data, &sz) < 0) {
@@ -56,6 +406,13 @@ int Zip_ReadByID(Zip* zip, size_t index, Memfile* mem) {
 	void* data = NULL;
 	size_t sz;
 	
+	if (zip->map.data) {
+		if (index >= zip->index.num)
+			return ZIP_ERROR_OPEN_ENTRY;
+		
+		return Zip_ReadEntry(zip, index, mem);
+	}
+	
 	if (zip_entry_openbyindex(zip->pkg, index))
 		return ZIP_ERROR_OPEN_ENTRY;
 	osLog("Reading Entry \"%s\"", zip_entry_name(zip->pkg));
@@ -84,12 +441,70 @@ int Zip_ReadByID(Zip* zip, size_t index, Memfile* mem) {
 	return 0;
 }
 
+/**
+ * Binary searches the sorted names for the first match of path, then
+ * visits the matching run in archive order.
+ */
+static int Zip_ReadPathIndexed(Zip* zip, const char* path, int (*callback)(const char* name, Memfile* mem)) {
+	size_t len = strlen(path);
+	u32 lo = 0, hi = zip->index.num;
+	u32 num = 0;
+	u32* match;
+	int ret = 0;
+	
+	while (lo < hi) {
+		u32 mid = (lo + hi) / 2;
+		
+		if (strncmp(zip->index.entry[zip->index.sorted[mid]].name, path, len) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	
+	for (hi = lo; hi < zip->index.num; hi++)
+		if (strncmp(zip->index.entry[zip->index.sorted[hi]].name, path, len))
+			break;
+	
+	match = malloc(sizeof(u32) * Max(hi - lo, 1));
+	for (u32 i = lo; i < hi; i++)
+		if (!zip->index.entry[zip->index.sorted[i]].isDir)
+			match[num++] = zip->index.sorted[i];
+	
+	nested(int, cmp, (const void* a, const void* b)) {
+		return (*(u32*)a > *(u32*)b) - (*(u32*)a < *(u32*)b);
+	};
+	
+	qsort(match, num, sizeof(u32), (void*)cmp);
+	
+	for (u32 i = 0; i < num; i++) {
+		Memfile mem = Memfile_New();
+		int brk;
+		
+		if ((ret = Zip_ReadEntry(zip, match[i], &mem)))
+			break;
+		
+		brk = callback(zip->index.entry[match[i]].name, &mem);
+		Memfile_Free(&mem);
+		
+		if (brk)
+			break;
+	}
+	
+	free(match);
+	
+	return ret;
+}
+
 int Zip_ReadPath(Zip* zip, const char* path, int (*callback)(const char* name, Memfile* mem)) {
-	u32 ent = zip_entries_total(zip->pkg);
+	u32 ent;
 	
 	if (callback == NULL)
 		errr("[Zip_ReadPath]: Please provide a callback function!");
 	
+	if (zip->map.data)
+		return Zip_ReadPathIndexed(zip, path, callback);
+	
+	ent = zip_entries_total(zip->pkg);
 	for (u32 i = 0; i < ent; i++) {
 		const char* name;
 		int ret;
@@ -190,11 +605,117 @@ static int Zip_DumpCall(Zip* zip, Memfile* mem, u32 i, f32 prcnt, int (*callback
 	return 0;
 }
 
+typedef struct {
+	Zip* zip;
+	const char* path;
+	int (*callback)(const char* name, f32 prcnt);
+	u32*    order;
+	u32     num;
+	u32     started;
+	mutex_t mutex;
+	vs32    ret;
+} ZipDump;
+
+static void Zip_DumpThd(ZipDump* this, u32 i) {
+	ZipEntry* e = &this->zip->index.entry[this->order[i]];
+	Memfile mem = Memfile_New();
+	char* file;
+	int ret;
+	
+	if (this->ret)
+		return;
+	
+	if (this->callback) {
+		int skip;
+		
+		mutex_lock(&this->mutex);
+		skip = this->callback(e->name, ((f32)++this->started / this->num) * 100.0f);
+		mutex_unlock(&this->mutex);
+		
+		if (skip)
+			return;
+	}
+	
+	if (e->isDir)
+		return;
+	
+	if ((ret = Zip_ReadEntry(this->zip, this->order[i], &mem))) {
+		this->ret = ret;
+		
+		return;
+	}
+	
+	file = fmt("%s%s", this->path, e->name);
+	if (Memfile_SaveBin(&mem, file))
+		this->ret = ZIP_ERROR_RW_ENTRY;
+	
+	Memfile_Free(&mem);
+	delete(file);
+}
+
+/**
+ * Extracts every entry across threads, biggest compressed size first so
+ * the long inflates do not end up last. Directories are created up front.
+ * The callback is serialized, but may be called from any thread.
+ */
+static int Zip_DumpIndexed(Zip* zip, const char* path, int (*callback)(const char* name, f32 prcnt)) {
+	ZipDump dump = {
+		.zip      = zip,
+		.path     = path,
+		.callback = callback,
+		.num      = zip->index.num,
+		.order    = malloc(sizeof(u32) * Max(zip->index.num, 1)),
+	};
+	const char* prev = NULL;
+	size_t prevLen = 0;
+	
+	fs_set(path);
+	sys_mkdir(path);
+	
+	// Sorted names keep files of one directory next to each other
+	for (u32 i = 0; i < zip->index.num; i++) {
+		ZipEntry* e = &zip->index.entry[zip->index.sorted[i]];
+		const char* slash = strrchr(e->name, '/');
+		size_t len = slash ? slash - e->name + 1 : 0;
+		
+		if (!len || (prev && len == prevLen && !strncmp(prev, e->name, len)))
+			continue;
+		
+		sys_mkdir("%s%.*s", path, (int)len, e->name);
+		prev = e->name;
+		prevLen = len;
+	}
+	
+	for (u32 i = 0; i < dump.num; i++)
+		dump.order[i] = i;
+	
+	nested(int, cmp, (const void* a, const void* b)) {
+		u64 sa = zip->index.entry[*(u32*)a].compSize;
+		u64 sb = zip->index.entry[*(u32*)b].compSize;
+		
+		return (sa < sb) - (sa > sb);
+	};
+	
+	qsort(dump.order, dump.num, sizeof(u32), (void*)cmp);
+	
+	mutex_init(&dump.mutex);
+	Parallel_For(dump.num, 0, Zip_DumpThd, &dump);
+	mutex_dest(&dump.mutex);
+	
+	free(dump.order);
+	
+	return dump.ret;
+}
+
 int Zip_Dump(Zip* zip, const char* path, int (*callback)(const char* name, f32 prcnt)) {
 	Memfile mem = Memfile_New();
-	u32 ent = zip_entries_total(zip->pkg);
+	u32 ent;
 	int ret;
 	
+	if (zip->map.data)
+		return Zip_DumpIndexed(zip, path, callback);
+	
+	ent = zip_entries_total(zip->pkg);
 	osLog("Entries: %d", ent);
 	for (u32 i = 0; i < ent; i++) {
 		fs_set(path);
@@ -208,4 +729,367 @@ int Zip_Dump(Zip* zip, const char* path, int (*callback)(const char* name, f32 p
 void Zip_Free(Zip* zip) {
 	delete(zip->filename);
 	zip_close(zip->pkg);
+	Zip_FreeIndex(zip);
+	Zip_Unmap(zip);
+}
+
+/*============================================================================*/
+
+#define ZIPWRITER_BATCH  (256 * 1024 * 1024)
+#define ZIPWRITER_SAMPLE (64 * 1024)
+
+static void Zip_Put16(u8* p, u16 v) {
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void Zip_Put32(u8* p, u32 v) {
+	Zip_Put16(p, v);
+	Zip_Put16(p + 2, v >> 16);
+}
+
+static void Zip_Put64(u8* p, u64 v) {
+	Zip_Put32(p, v);
+	Zip_Put32(p + 4, v >> 32);
+}
+
+static FILE* Zip_FOpen(const char* name, const char* mode) {
+	FILE* file;
+	
+#if _WIN32
+	wchar* name16 = calloc(strlen(name) * 4);
+	wchar* mode16 = calloc(strlen(mode) * 4);
+	strto16(name16, name);
+	strto16(mode16, mode);
+	
+	file = _wfopen(name16, mode16);
+	
+	delete(name16, mode16);
+#else
+	file = fopen(name, mode);
+#endif
+	
+	return file;
+}
+
+static u32 Zip_DosTime(time_t t) {
+	struct tm tm;
+	
+#ifdef _WIN32
+	localtime_s(&tm, &t);
+#else
+	localtime_r(&t, &tm);
+#endif
+	
+	if (tm.tm_year < 80)
+		return 0x00210000;
+	
+	return (u32)((tm.tm_year - 80) << 9 | (tm.tm_mon + 1) << 5 | tm.tm_mday) << 16 |
+		   (tm.tm_hour << 11 | tm.tm_min << 5 | tm.tm_sec / 2);
+}
+
+/**
+ * level is 0 - 10 like the rest of the zip code, 0 stores and a negative
+ * level takes the one given to ZipWriter_Init.
+ */
+void ZipWriter_Init(ZipWriter* this, int level) {
+	*this = (ZipWriter) {
+		.entry = Arli_New(ZipWriterEntry),
+		.level = level,
+		.time  = time(NULL),
+	};
+}
+
+// mem is read during ZipWriter_Write and has to stay alive until then
+void ZipWriter_AddMem(ZipWriter* this, const char* name, Memfile* mem, int level) {
+	ZipWriterEntry e = {
+		.name  = strdup(name),
+		.mem   = mem,
+		.level = level < 0 ? this->level : level,
+		.time  = this->time,
+	};
+	
+	Arli_Add(&this->entry, &e);
+}
+
+void ZipWriter_AddFile(ZipWriter* this, const char* name, const char* file, int level) {
+	ZipWriterEntry e = {
+		.name  = strdup(name),
+		.file  = strdup(file),
+		.level = level < 0 ? this->level : level,
+		.time  = sys_stat(file),
+	};
+	
+	Arli_Add(&this->entry, &e);
+}
+
+void ZipWriter_Free(ZipWriter* this) {
+	for (int i = 0; i < this->entry.num; i++) {
+		ZipWriterEntry* e = Arli_At(&this->entry, i);
+		
+		delete(e->name, e->file, e->comp);
+	}
+	
+	Arli_Free(&this->entry);
+}
+
+/**
+ * Deflates one entry. Large inputs first try a fast pass over a sample,
+ * if that barely shrinks the entry is stored without trying the rest.
+ */
+static void ZipWriter_Compress(Arli* entry, u32 i) {
+	ZipWriterEntry* e = Arli_At(entry, i);
+	Memfile load = Memfile_New();
+	Memfile* mem = e->mem;
+	size_t compSize = 0;
+	
+	if (e->file) {
+		load.param.throwError = false;
+		if (Memfile_LoadBin(&load, e->file)) {
+			e->error = ZIP_ERROR_OPEN_ENTRY;
+			
+			return;
+		}
+		mem = &load;
+	}
+	
+	e->size = mem->size;
+	e->crc32 = mz_crc32(MZ_CRC32_INIT, mem->data, mem->size);
+	e->method = 0;
+	
+	if (e->level > 0 && mem->size > 0) {
+		bool store = false;
+		
+		if (mem->size > ZIPWRITER_SAMPLE * 2) {
+			void* sample = tdefl_compress_mem_to_heap(mem->data, ZIPWRITER_SAMPLE, &compSize, tdefl_create_comp_flags_from_zip_params(1, -MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY));
+			
+			store = !sample || compSize > ZIPWRITER_SAMPLE * 0.98;
+			free(sample);
+		}
+		
+		if (!store) {
+			mz_uint flags = tdefl_create_comp_flags_from_zip_params(e->level, -MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY);
+			
+			e->comp = tdefl_compress_mem_to_heap(mem->data, mem->size, &compSize, flags);
+			
+			if (e->comp && compSize < mem->size) {
+				e->method = 8;
+				e->compSize = compSize;
+			} else
+				delete(e->comp);
+		}
+	}
+	
+	// Stored entries are written from the input, a loaded file is kept
+	if (!e->method) {
+		e->compSize = mem->size;
+		if (mem == &load) {
+			e->comp = load.data;
+			load.data = NULL;
+		}
+	}
+	
+	Memfile_Free(&load);
+}
+
+/**
+ * Zip64 extra field of an entry. The local header always carries both
+ * sizes once either of them is saturated, the central one only carries
+ * the saturated values. Returns the field length, 0 if none is needed.
+ */
+static int ZipWriter_Extra(ZipWriterEntry* e, u8* extra, bool local) {
+	bool big = e->size >= 0xFFFFFFFF || e->compSize >= 0xFFFFFFFF;
+	int len = 4;
+	
+	if (local) {
+		if (!big)
+			return 0;
+		
+		Zip_Put64(extra + len, e->size), len += 8;
+		Zip_Put64(extra + len, e->compSize), len += 8;
+	} else {
+		if (e->size >= 0xFFFFFFFF) Zip_Put64(extra + len, e->size), len += 8;
+		if (e->compSize >= 0xFFFFFFFF) Zip_Put64(extra + len, e->compSize), len += 8;
+		if (e->offset >= 0xFFFFFFFF) Zip_Put64(extra + len, e->offset), len += 8;
+		
+		if (len == 4)
+			return 0;
+	}
+	
+	Zip_Put16(extra, 0x0001);
+	Zip_Put16(extra + 2, len - 4);
+	
+	return len;
+}
+
+static u32 ZipWriter_Sat(u64 v) {
+	return v >= 0xFFFFFFFF ? 0xFFFFFFFF : v;
+}
+
+static int ZipWriter_Local(FILE* f, ZipWriterEntry* e) {
+	size_t nameLen = strlen(e->name);
+	u8 head[30];
+	u8 extra[20];
+	int extraLen = ZipWriter_Extra(e, extra, true);
+	u32 dos = Zip_DosTime(e->time);
+	const void* data = e->comp ? e->comp : e->mem->data;
+	
+	Zip_Put32(head, 0x04034B50);
+	Zip_Put16(head + 4, extraLen ? 45 : 20);
+	Zip_Put16(head + 6, 1 << 11);
+	Zip_Put16(head + 8, e->method);
+	Zip_Put32(head + 10, dos);
+	Zip_Put32(head + 14, e->crc32);
+	Zip_Put32(head + 18, extraLen ? 0xFFFFFFFF : e->compSize);
+	Zip_Put32(head + 22, extraLen ? 0xFFFFFFFF : e->size);
+	Zip_Put16(head + 26, nameLen);
+	Zip_Put16(head + 28, extraLen);
+	
+	if (fwrite(head, 30, 1, f) != 1 || fwrite(e->name, nameLen, 1, f) != 1)
+		return ZIP_ERROR_RW_ENTRY;
+	if (extraLen && fwrite(extra, extraLen, 1, f) != 1)
+		return ZIP_ERROR_RW_ENTRY;
+	if (e->compSize && fwrite(data, e->compSize, 1, f) != 1)
+		return ZIP_ERROR_RW_ENTRY;
+	
+	return 0;
+}
+
+static int ZipWriter_Central(FILE* f, ZipWriterEntry* e) {
+	size_t nameLen = strlen(e->name);
+	u8 head[46];
+	u8 extra[28];
+	int extraLen = ZipWriter_Extra(e, extra, false);
+	
+	Zip_Put32(head, 0x02014B50);
+	Zip_Put16(head + 4, extraLen ? 45 : 20);
+	Zip_Put16(head + 6, extraLen ? 45 : 20);
+	Zip_Put16(head + 8, 1 << 11);
+	Zip_Put16(head + 10, e->method);
+	Zip_Put32(head + 12, Zip_DosTime(e->time));
+	Zip_Put32(head + 16, e->crc32);
+	Zip_Put32(head + 20, ZipWriter_Sat(e->compSize));
+	Zip_Put32(head + 24, ZipWriter_Sat(e->size));
+	Zip_Put16(head + 28, nameLen);
+	Zip_Put16(head + 30, extraLen);
+	Zip_Put16(head + 32, 0);
+	Zip_Put16(head + 34, 0);
+	Zip_Put16(head + 36, 0);
+	Zip_Put32(head + 38, 0);
+	Zip_Put32(head + 42, ZipWriter_Sat(e->offset));
+	
+	if (fwrite(head, 46, 1, f) != 1 || fwrite(e->name, nameLen, 1, f) != 1)
+		return ZIP_ERROR_RW_ENTRY;
+	if (extraLen && fwrite(extra, extraLen, 1, f) != 1)
+		return ZIP_ERROR_RW_ENTRY;
+	
+	return 0;
+}
+
+static int ZipWriter_End(FILE* f, u64 num, u64 cdOffset, u64 cdSize) {
+	u8 end[22];
+	
+	if (num >= 0xFFFF || cdOffset >= 0xFFFFFFFF || cdSize >= 0xFFFFFFFF) {
+		u8 end64[56];
+		u8 loc[20];
+		
+		Zip_Put32(end64, 0x06064B50);
+		Zip_Put64(end64 + 4, 44);
+		Zip_Put16(end64 + 12, 45);
+		Zip_Put16(end64 + 14, 45);
+		Zip_Put32(end64 + 16, 0);
+		Zip_Put32(end64 + 20, 0);
+		Zip_Put64(end64 + 24, num);
+		Zip_Put64(end64 + 32, num);
+		Zip_Put64(end64 + 40, cdSize);
+		Zip_Put64(end64 + 48, cdOffset);
+		
+		Zip_Put32(loc, 0x07064B50);
+		Zip_Put32(loc + 4, 0);
+		Zip_Put64(loc + 8, cdOffset + cdSize);
+		Zip_Put32(loc + 16, 1);
+		
+		if (fwrite(end64, sizeof(end64), 1, f) != 1 || fwrite(loc, sizeof(loc), 1, f) != 1)
+			return ZIP_ERROR_RW_ENTRY;
+		
+		num = 0xFFFF;
+		cdOffset = 0xFFFFFFFF;
+		cdSize = 0xFFFFFFFF;
+	}
+	
+	Zip_Put32(end, 0x06054B50);
+	Zip_Put16(end + 4, 0);
+	Zip_Put16(end + 6, 0);
+	Zip_Put16(end + 8, num);
+	Zip_Put16(end + 10, num);
+	Zip_Put32(end + 12, cdSize);
+	Zip_Put32(end + 16, cdOffset);
+	Zip_Put16(end + 20, 0);
+	
+	return fwrite(end, sizeof(end), 1, f) == 1 ? 0 : ZIP_ERROR_RW_ENTRY;
+}
+
+/**
+ * Compresses the entries in batches of about ZIPWRITER_BATCH input bytes
+ * on Parallel_For, each batch is then appended by this thread in the
+ * order the entries were added, so the archive is deterministic.
+ */
+int ZipWriter_Write(ZipWriter* this, const char* file) {
+	FILE* f = Zip_FOpen(file, "wb");
+	u64 offset = 0;
+	u64 cdOffset;
+	u32 num = this->entry.num;
+	int ret = 0;
+	
+	if (!f)
+		return ZIP_ERROR_OPEN_ENTRY;
+	
+	for (u32 start = 0; start < num && !ret;) {
+		u32 end = start;
+		u64 batch = 0;
+		Arli sub;
+		
+		// File sizes are not known yet, those count as one batch slot each
+		while (end < num && (end == start || batch < ZIPWRITER_BATCH)) {
+			ZipWriterEntry* e = Arli_At(&this->entry, end++);
+			
+			batch += e->mem ? e->mem->size : ZIPWRITER_BATCH / 64;
+		}
+		
+		sub = this->entry;
+		sub.begin = Arli_At(&this->entry, start);
+		sub.num = end - start;
+		Parallel_For(end - start, 0, ZipWriter_Compress, &sub);
+		
+		for (; start < end; start++) {
+			ZipWriterEntry* e = Arli_At(&this->entry, start);
+			
+			if ((ret = e->error))
+				break;
+			
+			e->offset = offset;
+			if ((ret = ZipWriter_Local(f, e)))
+				break;
+			
+			offset += 30 + strlen(e->name) + ZipWriter_Extra(e, (u8[20]) {}, true) + e->compSize;
+			delete(e->comp);
+		}
+	}
+	
+	cdOffset = offset;
+	for (u32 i = 0; i < num && !ret; i++) {
+		ZipWriterEntry* e = Arli_At(&this->entry, i);
+		
+		if ((ret = ZipWriter_Central(f, e)))
+			break;
+		offset += 46 + strlen(e->name) + ZipWriter_Extra(e, (u8[28]) {}, false);
+	}
+	
+	if (!ret)
+		ret = ZipWriter_End(f, num, cdOffset, offset - cdOffset);
+	
+	if (fclose(f) && !ret)
+		ret = ZIP_ERROR_CLOSE;
+	
+	return ret;
 }
@@ -0,0 +1,314 @@
+#include "ext_zip.h"
+
+#define MINIZ_HEADER_FILE_ONLY
+#define MINIZ_NO_ZLIB_COMPATIBLE_NAMES
+#include "impl/miniz.h"
+
+#define ZSTREAM_CHUNK (1024 * 1024)
+#define ZSTREAM_MAGIC 0x4B425A4D // MZBK
+
+/*============================================================================*/
+
+static mz_bool ZStream_Put(const void* data, int len, void* udata) {
+	Memfile* out = udata;
+	
+	return Memfile_Write(out, data, len) == len;
+}
+
+/**
+ * Streams are zlib framed so anything else that speaks zlib can read them.
+ * Output is appended to out as it is produced, the caller may drain and
+ * rewind out between writes.
+ */
+void ZStream_Deflate(ZStream* this, Memfile* out, int level) {
+	mz_uint flags = tdefl_create_comp_flags_from_zip_params(level < 0 ? 4 : level, MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY);
+	
+	*this = (ZStream) {
+		.out   = out,
+		.state = tdefl_compressor_alloc(),
+	};
+	
+	osAssert(this->state);
+	tdefl_init(this->state, ZStream_Put, out, flags);
+}
+
+void ZStream_Inflate(ZStream* this, Memfile* out) {
+	*this = (ZStream) {
+		.out     = out,
+		.state   = tinfl_decompressor_alloc(),
+		.dict    = malloc(TINFL_LZ_DICT_SIZE),
+		.inflate = true,
+	};
+	
+	osAssert(this->state && this->dict);
+	tinfl_init((tinfl_decompressor*)this->state);
+}
+
+static int ZStream_Run(ZStream* this, const u8* data, size_t size, bool more) {
+	mz_uint32 flags = TINFL_FLAG_PARSE_ZLIB_HEADER | (more ? TINFL_FLAG_HAS_MORE_INPUT : 0);
+	
+	while (!this->done) {
+		size_t inSize = size;
+		size_t outSize = TINFL_LZ_DICT_SIZE - this->dictOfs;
+		tinfl_status status = tinfl_decompress(this->state, data, &inSize, this->dict, this->dict + this->dictOfs, &outSize, flags);
+		
+		data += inSize;
+		size -= inSize;
+		
+		if (outSize)
+			Memfile_Write(this->out, this->dict + this->dictOfs, outSize);
+		this->dictOfs = (this->dictOfs + outSize) & (TINFL_LZ_DICT_SIZE - 1);
+		
+		if (status < TINFL_STATUS_DONE)
+			return this->error = ZIP_ERROR_RW_ENTRY;
+		if (status == TINFL_STATUS_DONE)
+			this->done = true;
+		if (status == TINFL_STATUS_NEEDS_MORE_INPUT)
+			return more ? 0 : (this->error = ZIP_ERROR_RW_ENTRY);
+	}
+	
+	// Trailing bytes after the end of the stream
+	return size ? (this->error = ZIP_ERROR_RW_ENTRY) : 0;
+}
+
+int ZStream_Write(ZStream* this, const void* data, size_t size) {
+	if (this->error)
+		return this->error;
+	
+	if (this->inflate)
+		return ZStream_Run(this, data, size, true);
+	
+	if (tdefl_compress_buffer(this->state, data, size, TDEFL_NO_FLUSH) != TDEFL_STATUS_OKAY)
+		this->error = ZIP_ERROR_RW_ENTRY;
+	
+	return this->error;
+}
+
+// Finishes the stream and releases it, returns 0 if all of it was valid
+int ZStream_End(ZStream* this) {
+	if (!this->error) {
+		if (this->inflate)
+			ZStream_Run(this, NULL, 0, false);
+		else if (tdefl_compress_buffer(this->state, NULL, 0, TDEFL_FINISH) != TDEFL_STATUS_DONE)
+			this->error = ZIP_ERROR_RW_ENTRY;
+	}
+	
+	delete(this->state, this->dict);
+	
+	return this->error;
+}
+
+/*============================================================================*/
+
+typedef struct {
+	Memfile* src;
+	Memfile* dst;
+	u8**     comp;
+	u32*     compSize;
+	u32      blockSize;
+	mz_uint  flags;
+	int      error;
+} ZBlocks;
+
+static void ZBlocks_Compress(ZBlocks* this, u32 i) {
+	u32 size = Min(this->blockSize, this->src->size - i * this->blockSize);
+	size_t compSize = 0;
+	
+	this->comp[i] = tdefl_compress_mem_to_heap(this->src->cast.u8 + (size_t)i * this->blockSize, size, &compSize, this->flags);
+	this->compSize[i] = compSize;
+	
+	if (!this->comp[i])
+		this->error = ZIP_ERROR_RW_ENTRY;
+}
+
+static void ZBlocks_Decompress(ZBlocks* this, u32 i) {
+	u32 size = Min(this->blockSize, this->dst->size - i * this->blockSize);
+	const u8* comp = this->comp[0] + this->compSize[i];
+	u32 compSize = this->compSize[i + 1] - this->compSize[i];
+	
+	if (tinfl_decompress_mem_to_mem(this->dst->cast.u8 + (size_t)i * this->blockSize, size, comp, compSize, TINFL_FLAG_PARSE_ZLIB_HEADER) != size)
+		this->error = ZIP_ERROR_RW_ENTRY;
+}
+
+/**
+ * Compresses src into dst in one zlib stream. With a non zero blockSize the
+ * input is split into independent blocks that are compressed and later
+ * decompressed on Parallel_For, at some cost in ratio.
+ *
+ * Block layout:
+ *   u32 magic, u32 blockSize, u32 size, u32 num,
+ *   u32 end offset of each block relative to the first, blocks
+ */
+int Memfile_Compress(Memfile* dst, Memfile* src, int level, u32 blockSize) {
+	ZBlocks b = { .src = src, .blockSize = blockSize };
+	ZStream z;
+	u32 num;
+	
+	osAssert(dst != src);
+	Memfile_Null(dst);
+	
+	if (!blockSize) {
+		ZStream_Deflate(&z, dst, level);
+		ZStream_Write(&z, src->data, src->size);
+		
+		return ZStream_End(&z);
+	}
+	
+	num = (src->size + blockSize - 1) / blockSize;
+	b.flags = tdefl_create_comp_flags_from_zip_params(level < 0 ? 4 : level, MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY);
+	b.comp = new(u8*[num]);
+	b.compSize = new(u32[num]);
+	
+	Parallel_For(num, 0, ZBlocks_Compress, &b);
+	
+	if (!b.error) {
+		u32 head[4] = { ZSTREAM_MAGIC, blockSize, src->size, num };
+		u32 end = 0;
+		
+		Memfile_Realloc(dst, sizeof(head) + num * 4);
+		Memfile_Write(dst, head, sizeof(head));
+		
+		for (u32 i = 0; i < num; i++) {
+			end += b.compSize[i];
+			Memfile_Write(dst, &end, sizeof(end));
+		}
+		
+		Memfile_Realloc(dst, dst->size + end);
+		for (u32 i = 0; i < num; i++)
+			Memfile_Write(dst, b.comp[i], b.compSize[i]);
+	}
+	
+	for (u32 i = 0; i < num; i++)
+		free(b.comp[i]);
+	delete(b.comp, b.compSize);
+	
+	return b.error;
+}
+
+// Accepts both plain zlib streams and the block layout of Memfile_Compress
+int Memfile_Decompress(Memfile* dst, Memfile* src) {
+	const u32* head = src->data;
+	ZBlocks b = { .dst = dst };
+	ZStream z;
+	u32 num;
+	
+	osAssert(dst != src);
+	Memfile_Null(dst);
+	
+	if (src->size < 16 || head[0] != ZSTREAM_MAGIC) {
+		ZStream_Inflate(&z, dst);
+		ZStream_Write(&z, src->data, src->size);
+		
+		return ZStream_End(&z);
+	}
+	
+	b.blockSize = head[1];
+	num = head[3];
+	
+	if (!b.blockSize || num != (head[2] + (u64)b.blockSize - 1) / b.blockSize)
+		return ZIP_ERROR_RW_ENTRY;
+	if (16 + num * 4ull > src->size || 16 + num * 4ull + (num ? head[3 + num] : 0) > src->size)
+		return ZIP_ERROR_RW_ENTRY;
+	
+	b.compSize = new(u32[num + 1]);
+	b.comp = (u8*[]) { src->cast.u8 + 16 + num * 4 };
+	memcpy(b.compSize + 1, head + 4, num * 4);
+	
+	for (u32 i = 0; i < num; i++)
+		if (b.compSize[i + 1] < b.compSize[i])
+			b.error = ZIP_ERROR_RW_ENTRY;
+	
+	if (!b.error) {
+		Memfile_Realloc(dst, head[2] + 1);
+		dst->size = head[2];
+		Parallel_For(num, 0, ZBlocks_Decompress, &b);
+	}
+	
+	delete(b.compSize);
+	if (b.error)
+		Memfile_Null(dst);
+	
+	return b.error;
+}
+
+/**
+ * Streams the compressed contents to disk without holding the whole
+ * compressed copy in memory.
+ */
+int Memfile_SaveCompressed(Memfile* this, const char* file, int level) {
+	FILE* f = fopen(file, "wb");
+	Memfile out = Memfile_New();
+	ZStream z;
+	int ret = 0;
+	
+	if (!f)
+		return ZIP_ERROR_OPEN_ENTRY;
+	
+	Memfile_Alloc(&out, ZSTREAM_CHUNK * 2);
+	ZStream_Deflate(&z, &out, level);
+	
+	for (u32 i = 0; i < this->size && !ret; i += ZSTREAM_CHUNK) {
+		ret = ZStream_Write(&z, this->cast.u8 + i, Min(ZSTREAM_CHUNK, this->size - i));
+		
+		if (out.size && fwrite(out.data, out.size, 1, f) != 1)
+			ret = ZIP_ERROR_RW_ENTRY;
+		Memfile_Null(&out);
+	}
+	
+	if (ZStream_End(&z) && !ret)
+		ret = ZIP_ERROR_RW_ENTRY;
+	if (!ret && out.size && fwrite(out.data, out.size, 1, f) != 1)
+		ret = ZIP_ERROR_RW_ENTRY;
+	if (fclose(f) && !ret)
+		ret = ZIP_ERROR_CLOSE;
+	
+	Memfile_Free(&out);
+	
+	return ret;
+}
+
+// Inflates a zlib file while reading it, block layout files are loaded whole
+int Memfile_LoadCompressed(Memfile* this, const char* file) {
+	FILE* f = fopen(file, "rb");
+	u8* buf;
+	ZStream z;
+	size_t len;
+	int ret = 0;
+	
+	if (!f)
+		return ZIP_ERROR_OPEN_ENTRY;
+	
+	buf = malloc(ZSTREAM_CHUNK);
+	len = fread(buf, 1, ZSTREAM_CHUNK, f);
+	
+	if (len >= 16 && ((u32*)buf)[0] == ZSTREAM_MAGIC) {
+		Memfile comp = Memfile_New();
+		
+		fclose(f);
+		free(buf);
+		
+		comp.param.throwError = false;
+		if (Memfile_LoadBin(&comp, file))
+			return ZIP_ERROR_OPEN_ENTRY;
+		ret = Memfile_Decompress(this, &comp);
+		Memfile_Free(&comp);
+		
+		return ret;
+	}
+	
+	Memfile_Null(this);
+	ZStream_Inflate(&z, this);
+	
+	while (len && !ret) {
+		ret = ZStream_Write(&z, buf, len);
+		len = fread(buf, 1, ZSTREAM_CHUNK, f);
+	}
+	
+	if (ZStream_End(&z) && !ret)
+		ret = ZIP_ERROR_RW_ENTRY;
+	
+	free(buf);
+	fclose(f);
+	
+	return ret;
+}